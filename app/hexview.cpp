@@ -0,0 +1,315 @@
+#include "hexview.h"
+
+#include <QApplication>
+#include <QFontDatabase>
+#include <QHBoxLayout>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPushButton>
+#include <QScrollBar>
+#include <QVBoxLayout>
+
+#define super QAbstractScrollArea
+
+HexView::HexView(QWidget *parent) :
+  super(parent),
+  file_(nullptr),
+  start_(0),
+  size_(0),
+  selection_start_(-1),
+  selection_length_(0)
+{
+  setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  setFocusPolicy(Qt::StrongFocus);
+}
+
+void HexView::SetSource(si::FileBase *f, qint64 start, qint64 size)
+{
+  file_ = f;
+  start_ = start;
+  size_ = f ? size : 0;
+  selection_start_ = -1;
+  selection_length_ = 0;
+
+  verticalScrollBar()->setValue(0);
+  horizontalScrollBar()->setValue(0);
+  UpdateScrollBars();
+  viewport()->update();
+}
+
+void HexView::GoToOffset(qint64 offset)
+{
+  if (size_ == 0) {
+    return;
+  }
+
+  SetSelection(qBound(qint64(0), offset, size_ - 1), 1);
+}
+
+bool HexView::FindNext(const QByteArray &pattern)
+{
+  if (pattern.isEmpty() || pattern.size() > size_) {
+    return false;
+  }
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+
+  qint64 from = selection_start_ + 1;
+  qint64 found = Search(pattern, from, size_);
+  if (found == -1) {
+    found = Search(pattern, 0, from);
+  }
+
+  QApplication::restoreOverrideCursor();
+
+  if (found == -1) {
+    return false;
+  }
+
+  SetSelection(found, pattern.size());
+  return true;
+}
+
+qint64 HexView::Read(qint64 offset, char *data, qint64 size)
+{
+  file_->seek(start_ + offset);
+  return qint64(file_->ReadData(data, size));
+}
+
+qint64 HexView::Search(const QByteArray &pattern, qint64 from, qint64 to)
+{
+  // Blocks overlap by one byte short of the pattern so matches across their edges are found,
+  // and only one block is ever held however big the data is
+  QByteArray block;
+  for (qint64 pos = from; pos < to; pos += kSearchBlockSize) {
+    qint64 len = qMin(kSearchBlockSize + pattern.size() - 1, size_ - pos);
+    if (len < pattern.size()) {
+      break;
+    }
+
+    block.resize(len);
+    block.resize(Read(pos, block.data(), len));
+
+    qsizetype i = block.indexOf(pattern);
+    if (i != -1) {
+      return (pos + i < to) ? pos + i : -1;
+    }
+  }
+
+  return -1;
+}
+
+void HexView::SetSelection(qint64 offset, qint64 length)
+{
+  selection_start_ = offset;
+  selection_length_ = length;
+
+  // Bring the selection into view, roughly in the middle if it has to move
+  int row = int(offset / kBytesPerRow);
+  int first = verticalScrollBar()->value();
+  int visible = GetVisibleRows();
+  if (row < first || row >= first + visible) {
+    verticalScrollBar()->setValue(row - visible / 2);
+  }
+
+  viewport()->update();
+}
+
+void HexView::UpdateScrollBars()
+{
+  int rows = int((size_ + kBytesPerRow - 1) / kBytesPerRow);
+  int visible = GetVisibleRows();
+  verticalScrollBar()->setRange(0, qMax(0, rows - visible));
+  verticalScrollBar()->setPageStep(visible);
+
+  int width = (GetTextColumn(kBytesPerRow) + 1) * GetCharWidth();
+  horizontalScrollBar()->setRange(0, qMax(0, width - viewport()->width()));
+  horizontalScrollBar()->setPageStep(viewport()->width());
+}
+
+int HexView::GetVisibleRows() const
+{
+  return qMax(1, viewport()->height() / fontMetrics().height());
+}
+
+int HexView::GetCharWidth() const
+{
+  return fontMetrics().horizontalAdvance(QLatin1Char('0'));
+}
+
+int HexView::GetHexColumn(int i) const
+{
+  // 8 offset digits, then the bytes with an extra space halfway along
+  return 11 + i * 3 + i / 8;
+}
+
+int HexView::GetTextColumn(int i) const
+{
+  return GetHexColumn(kBytesPerRow) + 1 + i;
+}
+
+void HexView::paintEvent(QPaintEvent *)
+{
+  QPainter p(viewport());
+  p.setFont(font());
+
+  if (!file_) {
+    return;
+  }
+
+  int line_height = fontMetrics().height();
+  int ascent = fontMetrics().ascent();
+  int char_width = GetCharWidth();
+  int x_offset = -horizontalScrollBar()->value();
+
+  // One extra row for the one cut off at the bottom
+  qint64 first = qint64(verticalScrollBar()->value()) * kBytesPerRow;
+  qint64 count = qMin(qint64(GetVisibleRows() + 1) * kBytesPerRow, size_ - first);
+  if (count <= 0) {
+    return;
+  }
+
+  row_buffer_.resize(count);
+  count = Read(first, row_buffer_.data(), count);
+
+  QColor highlight = palette().color(QPalette::Highlight);
+  QColor text = palette().color(QPalette::Text);
+  QColor highlighted_text = palette().color(QPalette::HighlightedText);
+
+  for (qint64 row = 0; row * kBytesPerRow < count; row++) {
+    int y = int(row) * line_height;
+    qint64 row_offset = first + row * kBytesPerRow;
+
+    p.setPen(text);
+    p.drawText(x_offset + char_width, y + ascent, QStringLiteral("%1").arg(row_offset, 8, 16, QLatin1Char('0')).toUpper());
+
+    for (int i = 0; i < kBytesPerRow && row * kBytesPerRow + i < count; i++) {
+      qint64 offset = row_offset + i;
+      uchar b = uchar(row_buffer_.at(row * kBytesPerRow + i));
+
+      int hex_x = x_offset + GetHexColumn(i) * char_width;
+      int text_x = x_offset + GetTextColumn(i) * char_width;
+
+      bool selected = offset >= selection_start_ && offset < selection_start_ + selection_length_;
+      if (selected) {
+        p.fillRect(hex_x, y, char_width * 2, line_height, highlight);
+        p.fillRect(text_x, y, char_width, line_height, highlight);
+        p.setPen(highlighted_text);
+      } else {
+        p.setPen(text);
+      }
+
+      p.drawText(hex_x, y + ascent, QStringLiteral("%1").arg(uint(b), 2, 16, QLatin1Char('0')).toUpper());
+      p.drawText(text_x, y + ascent, (b >= 0x20 && b < 0x7F) ? QString(QLatin1Char(b)) : QStringLiteral("."));
+    }
+  }
+}
+
+void HexView::resizeEvent(QResizeEvent *e)
+{
+  super::resizeEvent(e);
+  UpdateScrollBars();
+}
+
+void HexView::mousePressEvent(QMouseEvent *e)
+{
+  if (!file_ || e->button() != Qt::LeftButton) {
+    super::mousePressEvent(e);
+    return;
+  }
+
+  int char_width = GetCharWidth();
+  int col = (int(e->position().x()) + horizontalScrollBar()->value()) / char_width;
+  qint64 row = verticalScrollBar()->value() + int(e->position().y()) / fontMetrics().height();
+
+  // Clicking either the hex or the text of a byte selects it
+  int i = -1;
+  if (col >= GetTextColumn(0) && col < GetTextColumn(kBytesPerRow)) {
+    i = col - GetTextColumn(0);
+  } else {
+    for (int j = 0; j < kBytesPerRow; j++) {
+      if (col >= GetHexColumn(j) && col < GetHexColumn(j) + 2) {
+        i = j;
+        break;
+      }
+    }
+  }
+
+  qint64 offset = row * kBytesPerRow + i;
+  if (i != -1 && offset < size_) {
+    SetSelection(offset, 1);
+  }
+}
+
+HexViewer::HexViewer(QWidget *parent) :
+  QWidget(parent)
+{
+  auto layout = new QVBoxLayout(this);
+  layout->setContentsMargins(0, 0, 0, 0);
+
+  auto toolbar = new QHBoxLayout();
+  layout->addLayout(toolbar);
+
+  offset_edit_ = new QLineEdit();
+  offset_edit_->setPlaceholderText(tr("Offset (hex)"));
+  connect(offset_edit_, &QLineEdit::returnPressed, this, &HexViewer::GoToOffset);
+  toolbar->addWidget(offset_edit_);
+
+  auto goto_btn = new QPushButton(tr("Go To"));
+  connect(goto_btn, &QPushButton::clicked, this, &HexViewer::GoToOffset);
+  toolbar->addWidget(goto_btn);
+
+  find_edit_ = new QLineEdit();
+  find_edit_->setPlaceholderText(tr("Bytes (hex), e.g. 52 49 46 46"));
+  connect(find_edit_, &QLineEdit::returnPressed, this, &HexViewer::FindNext);
+  toolbar->addWidget(find_edit_, 1);
+
+  auto find_btn = new QPushButton(tr("Find Next"));
+  connect(find_btn, &QPushButton::clicked, this, &HexViewer::FindNext);
+  toolbar->addWidget(find_btn);
+
+  view_ = new HexView();
+  layout->addWidget(view_, 1);
+
+  status_lbl_ = new QLabel();
+  layout->addWidget(status_lbl_);
+}
+
+void HexViewer::SetSource(si::FileBase *f, qint64 start, qint64 size)
+{
+  view_->SetSource(f, start, size);
+  status_lbl_->setText(f ? tr("%1 bytes").arg(size) : QString());
+}
+
+void HexViewer::GoToOffset()
+{
+  QString s = offset_edit_->text().trimmed();
+  if (s.startsWith(QStringLiteral("0x"), Qt::CaseInsensitive)) {
+    s = s.mid(2);
+  }
+
+  bool ok;
+  qint64 offset = s.toLongLong(&ok, 16);
+  if (!ok || offset < 0 || offset >= view_->GetSize()) {
+    status_lbl_->setText(tr("Offset is out of range"));
+    return;
+  }
+
+  view_->GoToOffset(offset);
+  status_lbl_->setText(tr("Offset 0x%1").arg(QString::number(offset, 16).toUpper()));
+}
+
+void HexViewer::FindNext()
+{
+  QByteArray pattern = QByteArray::fromHex(find_edit_->text().toLatin1());
+  if (pattern.isEmpty()) {
+    status_lbl_->setText(tr("Enter the bytes to find in hex"));
+    return;
+  }
+
+  if (view_->FindNext(pattern)) {
+    status_lbl_->clear();
+  } else {
+    status_lbl_->setText(tr("Not found"));
+  }
+}
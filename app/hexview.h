@@ -0,0 +1,81 @@
+#ifndef HEXVIEW_H
+#define HEXVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QLabel>
+#include <QLineEdit>
+#include <QWidget>
+
+#include <file.h>
+
+class HexView : public QAbstractScrollArea
+{
+  Q_OBJECT
+public:
+  explicit HexView(QWidget *parent = nullptr);
+
+  // Shows size bytes of f from start onwards. Only the rows on screen are ever read, so f must
+  // stay open until the source is changed again.
+  void SetSource(si::FileBase *f, qint64 start, qint64 size);
+
+  qint64 GetSize() const { return size_; }
+
+  void GoToOffset(qint64 offset);
+
+  // Searches after the current selection, wrapping around to the start
+  bool FindNext(const QByteArray &pattern);
+
+protected:
+  virtual void paintEvent(QPaintEvent *e) override;
+  virtual void resizeEvent(QResizeEvent *e) override;
+  virtual void mousePressEvent(QMouseEvent *e) override;
+
+private:
+  static const int kBytesPerRow = 16;
+  static const qint64 kSearchBlockSize = 64 * 1024;
+
+  qint64 Read(qint64 offset, char *data, qint64 size);
+  qint64 Search(const QByteArray &pattern, qint64 from, qint64 to);
+
+  void SetSelection(qint64 offset, qint64 length);
+  void UpdateScrollBars();
+
+  int GetVisibleRows() const;
+  int GetCharWidth() const;
+  int GetHexColumn(int i) const;
+  int GetTextColumn(int i) const;
+
+  si::FileBase *file_;
+  qint64 start_;
+  qint64 size_;
+
+  qint64 selection_start_;
+  qint64 selection_length_;
+
+  // Holds just the rows on screen, reused for every paint
+  QByteArray row_buffer_;
+
+};
+
+class HexViewer : public QWidget
+{
+  Q_OBJECT
+public:
+  explicit HexViewer(QWidget *parent = nullptr);
+
+  void SetSource(si::FileBase *f, qint64 start, qint64 size);
+
+private:
+  HexView *view_;
+
+  QLineEdit *offset_edit_;
+  QLineEdit *find_edit_;
+  QLabel *status_lbl_;
+
+private slots:
+  void GoToOffset();
+  void FindNext();
+
+};
+
+#endif // HEXVIEW_H
@@ -2,10 +2,14 @@
 
 #include <QApplication>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QLineEdit>
 #include <QMenuBar>
 #include <QMessageBox>
 #include <QSplitter>
+#include <extractor.h>
+#include <importer.h>
+#include <tuner.h>
 
 #include "siview/siview.h"
 
@@ -120,6 +124,9 @@ void MainWindow::OpenFilename(const QString &s)
     //tree_->blockSignals(true);
     model_.SetCore(&interleaf_);
 //    tree_->blockSignals(false);
+    layout_filename_ = s;
+  } else {
+    layout_filename_.clear();
   }
 }
 
@@ -143,6 +150,8 @@ void MainWindow::InitializeMenuBar()
 
   file_menu->addAction(tr("E&xtract All"), this, &MainWindow::ExtractAll);
 
+  file_menu->addAction(tr("&Replace All"), this, &MainWindow::ReplaceAll);
+
   file_menu->addSeparator();
 
   file_menu->addAction(tr("E&xit"), this, &MainWindow::close);
@@ -166,6 +175,10 @@ void MainWindow::SetPanel(Panel *panel, si::Object *chunk)
   action_grp_->setEnabled(chunk);
   properties_group_->setEnabled(chunk);
 
+  // Populating the editors shouldn't count as modifying the object
+  m_extraEdit->blockSignals(true);
+  start_time_edit_->blockSignals(true);
+
   if (chunk) {
     m_extraEdit->setPlainText(QString::fromUtf8(chunk->extra_.data()));
     m_LocationEdit->SetValue(chunk->location_);
@@ -177,6 +190,9 @@ void MainWindow::SetPanel(Panel *panel, si::Object *chunk)
     m_UpEdit->SetValue(si::Vector3(0, 0, 0));
     start_time_edit_->setValue(0);
   }
+
+  m_extraEdit->blockSignals(false);
+  start_time_edit_->blockSignals(false);
 }
 
 void MainWindow::UpdateWindowTitle(QString filename)
@@ -213,14 +229,22 @@ void MainWindow::ReplaceObject(si::Object *obj)
 {
   QString s = QFileDialog::getOpenFileName(this, tr("Replace Object"));
   if (!s.isEmpty()) {
-    if (obj->ReplaceWithFile(
+    // Panels can read straight from the object's chunks, so let go of them while they're replaced
+    auto panel = static_cast<Panel*>(config_stack_->currentWidget());
+    void *data = panel->GetData();
+    panel->SetData(nullptr);
+
+    bool replaced = obj->ReplaceWithFile(
 #ifdef Q_OS_WINDOWS
           s.toStdWString().c_str()
 #else
           s.toUtf8()
 #endif
-        )) {
-      static_cast<Panel*>(config_stack_->currentWidget())->ResetData();
+        );
+
+    panel->SetData(data);
+
+    if (replaced) {
       setWindowModified(true);
 
     } else {
@@ -229,14 +253,15 @@ void MainWindow::ReplaceObject(si::Object *obj)
   }
 }
 
-bool MainWindow::OpenInterleafFileInternal(QWidget *parent, si::Interleaf *interleaf, const QString &s)
+bool MainWindow::OpenInterleafFileInternal(QWidget *parent, si::Interleaf *interleaf, const QString &s, int flags)
 {
   Interleaf::Error r = interleaf->Read(
 #ifdef Q_OS_WINDOWS
-    s.toStdWString().c_str()
+    s.toStdWString().c_str(),
 #else
-    s.toUtf8()
+    s.toUtf8(),
 #endif
+    flags
   );
 
   if (r == Interleaf::ERROR_SUCCESS) {
@@ -252,39 +277,6 @@ QString MainWindow::GetOpenFileName()
   return QFileDialog::getOpenFileName(this, QString(), QString(), kFileFilter);
 }
 
-bool MainWindow::ExtractAllRecursiveInternal(const QDir &dir, const si::Core *obj)
-{
-  if (!dir.mkpath(QStringLiteral("."))) {
-    QMessageBox::critical(this, tr("Extract All Failed"), tr("Failed to create directory \"%1\". Try extracting somewhere else.").arg(dir.absolutePath()));
-    return false;
-  }
-
-  for (const Core *child : obj->GetChildren()) {
-    if (const Object *obj = dynamic_cast<const Object*>(child)) {
-      if (!obj->data().empty()) {
-        QString realFilename = QString::fromStdString(obj->filename());
-        realFilename = realFilename.mid(realFilename.lastIndexOf('\\')+1);
-
-        QString output = dir.filePath(realFilename);
-
-        if (!obj->ExtractToFile(output.toUtf8())) {
-          QMessageBox::critical(this, tr("Extract All Failed"), tr("Failed to create file \"%1\". Try extracting somewhere else.").arg(output));
-          return false;
-        }
-      }
-
-      if (obj->HasChildren()) {
-        // Extract its children too
-        if (!ExtractAllRecursiveInternal(QDir(dir.filePath(QString::fromStdString(obj->name()))), obj)) {
-          return false;
-        }
-      }
-    }
-  }
-
-  return true;
-}
-
 void MainWindow::TrimOffDirectory(QString& s)
 {
   int bSlashIndex = s.lastIndexOf('\\');
@@ -303,6 +295,7 @@ void MainWindow::NewFile()
   model_.SetCore(nullptr);
   interleaf_.Clear();
   model_.SetCore(&interleaf_);
+  layout_filename_.clear();
 
   UpdateWindowTitle(tr("UNTITLED.SI"));
 }
@@ -321,15 +314,57 @@ bool MainWindow::SaveFile()
   if (current_filename_.isEmpty()) {
     return SaveFileAs();
   } else {
-    Interleaf::Error r = interleaf_.Write(
+    Interleaf::Error r;
+
+    // New files don't have a buffer layout yet, so work one out
+    if (interleaf_.GetBufferSize() == 0) {
+      BufferTuning tuning;
+      if (BufferTuner::Tune(&interleaf_, BufferTuner::Settings(), &tuning) == Interleaf::ERROR_SUCCESS
+          && tuning.recommended < tuning.candidates.size()) {
+        const BufferTuning::Candidate &c = tuning.candidates.at(tuning.recommended);
+        interleaf_.SetBufferSize(c.buffer_size);
+        interleaf_.SetBufferCount(c.buffer_count);
+      }
+    }
+
+    // If we're saving over the file we last read or wrote, only the modified streams need writing.
+    // Compare where the paths actually lead, since writing a fresh file over the layout's source
+    // would truncate it before its streams could be copied.
+    QString current_canonical = QFileInfo(current_filename_).canonicalFilePath();
+    if (current_filename_ == layout_filename_
+        || (!current_canonical.isEmpty() && current_canonical == QFileInfo(layout_filename_).canonicalFilePath())) {
+      r = interleaf_.WriteModified(
+#ifdef Q_OS_WINDOWS
+        current_filename_.toStdWString().c_str()
+#else
+        current_filename_.toUtf8()
+#endif
+      );
+    } else if (!layout_filename_.isEmpty()) {
+      // Saving somewhere new, unchanged streams can still be copied from the last file
+      r = interleaf_.WriteCopyingUnchanged(
 #ifdef Q_OS_WINDOWS
-      current_filename_.toStdWString().c_str()
+        current_filename_.toStdWString().c_str(),
+        layout_filename_.toStdWString().c_str(),
 #else
-      current_filename_.toUtf8()
+        current_filename_.toUtf8(),
+        layout_filename_.toUtf8(),
 #endif
-    );
+        Interleaf::WriteParallel
+      );
+    } else {
+      r = interleaf_.Write(
+#ifdef Q_OS_WINDOWS
+        current_filename_.toStdWString().c_str(),
+#else
+        current_filename_.toUtf8(),
+#endif
+        Interleaf::WriteParallel
+      );
+    }
 
     if (r == Interleaf::ERROR_SUCCESS) {
+      layout_filename_ = current_filename_;
       UpdateWindowTitle(current_filename_);
       return true;
     } else {
@@ -402,8 +437,9 @@ void MainWindow::ViewSIFile()
   QString s = GetOpenFileName();
   if (!s.isEmpty()) {
     std::unique_ptr<Interleaf> temp = std::make_unique<Interleaf>();
-    if (OpenInterleafFileInternal(this, temp.get(), s)) {
-      SIViewDialog *v = new SIViewDialog(temp->GetInformation(), this);
+    // Only the structure is shown, data is read from the file when asked for
+    if (OpenInterleafFileInternal(this, temp.get(), s, Interleaf::IncludeChunkTable)) {
+      SIViewDialog *v = new SIViewDialog(&temp->GetChunkTable(), s, this);
       v->SetSubtitle(QFileInfo(s).fileName());
       v->temp = std::move(temp);
       v->setAttribute(Qt::WA_DeleteOnClose);
@@ -425,7 +461,65 @@ void MainWindow::ExtractAll()
     return;
   }
 
-  ExtractAllRecursiveInternal(dir, &interleaf_);
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  ExtractReport report;
+  Extractor::ExtractAll(&interleaf_, dir.absolutePath().toStdString(), &report);
+  QApplication::restoreOverrideCursor();
+
+  if (!report.errors.empty()) {
+    // List the first few, one bad directory can easily fail hundreds of files
+    static const size_t kMaxListed = 10;
+    QStringList paths;
+    for (size_t i = 0; i < report.errors.size() && i < kMaxListed; i++) {
+      paths.append(QString::fromStdString(report.errors[i].path));
+    }
+    if (report.errors.size() > kMaxListed) {
+      paths.append(tr("...and %1 more").arg(report.errors.size() - kMaxListed));
+    }
+
+    QMessageBox::critical(this, tr("Extract All Failed"), tr("%1 file(s) or directories couldn't be created. Try extracting somewhere else.\n\n%2").arg(report.errors.size()).arg(paths.join('\n')));
+  }
+}
+
+void MainWindow::ReplaceAll()
+{
+  QString s = QFileDialog::getExistingDirectory(this, tr("Replace All From..."));
+  if (s.isEmpty()) {
+    return;
+  }
+
+  // Panels can read straight from the object's chunks, so let go of them while they're replaced
+  auto panel = static_cast<Panel*>(config_stack_->currentWidget());
+  void *data = panel->GetData();
+  panel->SetData(nullptr);
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  ImportReport report;
+  Importer::ReplaceAll(&interleaf_, QDir(s).absolutePath().toStdString(), &report);
+  QApplication::restoreOverrideCursor();
+
+  panel->SetData(data);
+
+  if (report.replaced) {
+    setWindowModified(true);
+  }
+
+  if (report.failed) {
+    static const size_t kMaxListed = 10;
+    QStringList paths;
+    for (size_t i = 0; i < report.results.size() && size_t(paths.size()) < kMaxListed; i++) {
+      if (!report.results[i].replaced) {
+        paths.append(QString::fromStdString(report.results[i].path));
+      }
+    }
+    if (report.failed > kMaxListed) {
+      paths.append(tr("...and %1 more").arg(report.failed - kMaxListed));
+    }
+
+    QMessageBox::warning(this, tr("Replace All"), tr("Replaced %1 object(s), but %2 file(s) couldn't be used.\n\n%3").arg(report.replaced).arg(report.failed).arg(paths.join('\n')));
+  } else {
+    QMessageBox::information(this, tr("Replace All"), tr("Replaced %1 object(s).").arg(report.replaced));
+  }
 }
 
 void MainWindow::ExtraChanged()
@@ -433,28 +527,29 @@ void MainWindow::ExtraChanged()
   if (last_set_data_) {
     auto edit = static_cast<QPlainTextEdit*>(sender());
     QString v = edit->toPlainText();
-    last_set_data_->extra_ = bytearray(v.toUtf8(), v.size() + 1);
-    last_set_data_->extra_[v.size()] = 0;
+    bytearray extra(v.toUtf8(), v.size() + 1);
+    extra[v.size()] = 0;
+    last_set_data_->SetExtra(extra);
   }
 }
 
 void MainWindow::LocationChanged(const Vector3 &v)
 {
   if (last_set_data_) {
-    last_set_data_->location_ = v;
+    last_set_data_->SetLocation(v);
   }
 }
 
 void MainWindow::UpChanged(const si::Vector3 &v)
 {
   if (last_set_data_) {
-    last_set_data_->up_ = v;
+    last_set_data_->SetUp(v);
   }
 }
 
 void MainWindow::StartTimeChanged(int t)
 {
   if (last_set_data_) {
-    last_set_data_->time_offset_ = t;
+    last_set_data_->SetTimeOffset(t);
   }
 }
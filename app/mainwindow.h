@@ -33,12 +33,10 @@ private:
   void ExtractObject(si::Object *obj);
   void ReplaceObject(si::Object *obj);
 
-  static bool OpenInterleafFileInternal(QWidget *parent, si::Interleaf *interleaf, const QString &s);
+  static bool OpenInterleafFileInternal(QWidget *parent, si::Interleaf *interleaf, const QString &s, int flags = si::Interleaf::IncludeData | si::Interleaf::IncludeInfo);
 
   QString GetOpenFileName();
 
-  bool ExtractAllRecursiveInternal(const QDir &dir, const si::Core *obj);
-
   void TrimOffDirectory(QString &s);
 
   void UpdateWindowTitle(QString filename);
@@ -61,6 +59,9 @@ private:
 
   QString current_filename_;
 
+  // File whose layout interleaf_ currently knows, saving over it only writes what changed
+  QString layout_filename_;
+
   QGroupBox *properties_group_;
 
   QPlainTextEdit *m_extraEdit;
@@ -86,6 +87,7 @@ private slots:
 
   void ViewSIFile();
   void ExtractAll();
+  void ReplaceAll();
 
   void ExtraChanged();
   void LocationChanged(const si::Vector3 &v);
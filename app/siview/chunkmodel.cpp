@@ -3,15 +3,85 @@
 #include <iostream>
 #include <sitypes.h>
 
-#define super Model
+#define super QAbstractItemModel
 
 using namespace si;
 
 ChunkModel::ChunkModel(QObject *parent) :
-  super{parent}
+  super{parent},
+  table_(nullptr),
+  last_parent_(ChunkTable::NONE),
+  last_row_(0),
+  last_chunk_(ChunkTable::NONE)
 {
 }
 
+void ChunkModel::SetTable(const ChunkTable *table)
+{
+  beginResetModel();
+  table_ = table;
+  last_parent_ = ChunkTable::NONE;
+  endResetModel();
+}
+
+uint32_t ChunkModel::GetChunkFromIndex(const QModelIndex &index)
+{
+  // The root chunk is never shown, so it stands in for the invalid index
+  return index.isValid() ? uint32_t(index.internalId()) : 0;
+}
+
+QModelIndex ChunkModel::index(int row, int column, const QModelIndex &parent) const
+{
+  if (!table_ || table_->empty()) {
+    return QModelIndex();
+  }
+
+  uint32_t p = GetChunkFromIndex(parent);
+  uint32_t r = uint32_t(row);
+  uint32_t c;
+  if (p == last_parent_ && r >= last_row_) {
+    c = last_chunk_;
+    for (uint32_t i = last_row_; i < r && c != ChunkTable::NONE; i++) {
+      c = table_->at(c).next_sibling;
+    }
+  } else {
+    c = table_->GetChild(p, r);
+  }
+
+  if (c == ChunkTable::NONE) {
+    return QModelIndex();
+  }
+
+  last_parent_ = p;
+  last_row_ = r;
+  last_chunk_ = c;
+
+  return createIndex(row, column, quintptr(c));
+}
+
+QModelIndex ChunkModel::parent(const QModelIndex &index) const
+{
+  if (!index.isValid()) {
+    return QModelIndex();
+  }
+
+  uint32_t p = table_->at(GetChunkFromIndex(index)).parent;
+  if (p == 0 || p == ChunkTable::NONE) {
+    return QModelIndex();
+  }
+
+  return createIndex(int(table_->at(p).row), 0, quintptr(p));
+}
+
+int ChunkModel::rowCount(const QModelIndex &parent) const
+{
+  if (!table_ || table_->empty()) {
+    return 0;
+  }
+
+  return int(table_->at(GetChunkFromIndex(parent)).child_count);
+}
+
 int ChunkModel::columnCount(const QModelIndex &parent) const
 {
   return kColCount;
@@ -19,28 +89,28 @@ int ChunkModel::columnCount(const QModelIndex &parent) const
 
 QVariant ChunkModel::data(const QModelIndex &index, int role) const
 {
-  Info *c = static_cast<Info*>(GetCoreFromIndex(index));
-  if (!c) {
+  if (!index.isValid()) {
     return QVariant();
   }
 
+  const ChunkTable::Chunk &c = table_->at(GetChunkFromIndex(index));
+
   switch (role) {
   case Qt::DisplayRole:
 
     switch (index.column()) {
     case kColType:
       // Convert 4-byte ID to QString
-      return QString::fromLatin1(reinterpret_cast<const char *>(&c->GetType()), sizeof(uint32_t));
+      return QString::fromLatin1(reinterpret_cast<const char *>(&c.type), sizeof(uint32_t));
     case kColOffset:
-      return QStringLiteral("0x%1").arg(QString::number(c->GetOffset(), 16).toUpper());
+      return QStringLiteral("0x%1").arg(QString::number(c.offset, 16).toUpper());
     case kColSize:
-      return QStringLiteral("0x%1").arg(QString::number(c->GetSize(), 16).toUpper());
+      return QStringLiteral("0x%1").arg(QString::number(c.size, 16).toUpper());
     case kColDesc:
-      return QString::fromUtf8(RIFF::GetTypeDescription(static_cast<RIFF::Type>(c->GetType())));
+      return QString::fromUtf8(RIFF::GetTypeDescription(static_cast<RIFF::Type>(c.type)));
     case kColObjectID:
-      uint32_t i = c->GetObjectID();
-      if (i != Info::NULL_OBJECT_ID) {
-        return QString::number(i);
+      if (c.object_id != ChunkTable::NONE) {
+        return QString::number(c.object_id);
       }
       break;
     }
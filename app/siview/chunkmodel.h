@@ -1,11 +1,10 @@
 #ifndef CHUNKMODEL_H
 #define CHUNKMODEL_H
 
-#include <info.h>
+#include <chunktable.h>
+#include <QAbstractItemModel>
 
-#include "model.h"
-
-class ChunkModel : public Model
+class ChunkModel : public QAbstractItemModel
 {
   Q_OBJECT
 public:
@@ -22,10 +21,27 @@ public:
 
   explicit ChunkModel(QObject *parent = nullptr);
 
+  void SetTable(const si::ChunkTable *table);
+
+  // Chunks are identified by their index in the table
+  static uint32_t GetChunkFromIndex(const QModelIndex &index);
+
+  virtual QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+  virtual QModelIndex parent(const QModelIndex &index) const override;
+  virtual int rowCount(const QModelIndex &parent = QModelIndex()) const override;
   virtual int columnCount(const QModelIndex &parent = QModelIndex()) const override;
   virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
   virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
 
+private:
+  const si::ChunkTable *table_;
+
+  // Views ask for rows in order, so remembering the last one found saves walking siblings
+  // from the start every time
+  mutable uint32_t last_parent_;
+  mutable uint32_t last_row_;
+  mutable uint32_t last_chunk_;
+
 };
 
 #endif // CHUNKMODEL_H
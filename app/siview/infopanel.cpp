@@ -1,11 +1,12 @@
 #include "infopanel.h"
 
-#include <info.h>
 #include <QDebug>
+#include <QMessageBox>
 #include <QScrollArea>
 
 InfoPanel::InfoPanel(QWidget *parent) :
-  Panel(parent)
+  Panel(parent),
+  m_Table(nullptr)
 {
   int row = 0;
 
@@ -26,20 +27,32 @@ InfoPanel::InfoPanel(QWidget *parent) :
 
   row++;
 
-  m_DataView = new QPlainTextEdit();
-  m_DataView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  m_DataView = new HexViewer();
   layout()->addWidget(m_DataView, row, 0);
   m_DataView->hide();
 
   //FinishLayout();
 }
 
+void InfoPanel::SetSource(const si::ChunkTable *table, const QString &filename)
+{
+  SetData(nullptr);
+  m_Table = table;
+  m_Filename = filename;
+}
+
+uint32_t InfoPanel::GetChunk() const
+{
+  // Data is a pointer to the chunk's entry in the table
+  return uint32_t(static_cast<const si::ChunkTable::Chunk*>(this->GetData()) - &m_Table->at(0));
+}
+
 void InfoPanel::OnOpeningData(void *data)
 {
-  auto info = static_cast<si::Info*>(data);
-  m_Lbl->setText(QString::fromStdString(info->GetDescription()));
+  uint32_t chunk = GetChunk();
+  m_Lbl->setText(QString::fromStdString(m_Table->GetDescription(chunk)));
 
-  if (!info->GetData().empty()) {
+  if (m_Table->HasData(chunk)) {
     m_ShowDataBtn->show();
   }
 }
@@ -48,15 +61,29 @@ void InfoPanel::OnClosingData(void *data)
 {
   m_Lbl->setText(QString());
   m_DataView->hide();
-  m_DataView->clear();
+  m_DataView->SetSource(nullptr, 0, 0);
+  m_File.reset();
   m_ShowDataBtn->hide();
 }
 
 void InfoPanel::ShowData()
 {
-  const si::bytearray &s = static_cast<si::Info*>(this->GetData())->GetData();
+  // The viewer reads only what's on screen straight from the file, however big the chunk is
+  m_File = std::make_unique<si::File>();
+  if (!m_File->Open(
+#ifdef Q_OS_WINDOWS
+    m_Filename.toStdWString().c_str(),
+#else
+    m_Filename.toUtf8(),
+#endif
+    si::File::Read)) {
+    m_File.reset();
+    QMessageBox::critical(this, QString(), tr("Failed to read chunk data from %1").arg(m_Filename));
+    return;
+  }
 
+  uint32_t chunk = GetChunk();
   m_ShowDataBtn->hide();
-  m_DataView->setPlainText(QByteArray(s.data(), s.size()).toHex());
+  m_DataView->SetSource(m_File.get(), m_Table->GetDataOffset(chunk), m_Table->GetDataSize(chunk));
   m_DataView->show();
 }
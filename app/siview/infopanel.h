@@ -1,10 +1,13 @@
 #ifndef INFOPANEL_H
 #define INFOPANEL_H
 
+#include <chunktable.h>
+#include <file.h>
+#include <memory>
 #include <QLabel>
-#include <QPlainTextEdit>
 #include <QPushButton>
 
+#include "hexview.h"
 #include "panel.h"
 
 class InfoPanel : public Panel
@@ -13,16 +16,27 @@ class InfoPanel : public Panel
 public:
   InfoPanel(QWidget *parent = nullptr);
 
+  // Data is read from the file when asked for, so the panel needs to know where the table came from
+  void SetSource(const si::ChunkTable *table, const QString &filename);
+
 protected:
   virtual void OnOpeningData(void *data) override;
   virtual void OnClosingData(void *data) override;
 
 private:
+  uint32_t GetChunk() const;
+
+  const si::ChunkTable *m_Table;
+  QString m_Filename;
+
   QLabel *m_Lbl;
 
   QPushButton *m_ShowDataBtn;
 
-  QPlainTextEdit *m_DataView;
+  // Open only while data is being shown
+  std::unique_ptr<si::File> m_File;
+
+  HexViewer *m_DataView;
 
 private slots:
   void ShowData();
@@ -8,10 +8,9 @@
 
 using namespace si;
 
-SIViewDialog::SIViewDialog(Info *riff, QWidget *parent) :
+SIViewDialog::SIViewDialog(const ChunkTable *table, const QString &filename, QWidget *parent) :
   QWidget(parent, Qt::Window),
-  root_(riff),
-  last_set_data_(nullptr)
+  table_(table)
 {
   auto layout = new QVBoxLayout(this);
 
@@ -20,7 +19,7 @@ SIViewDialog::SIViewDialog(Info *riff, QWidget *parent) :
   layout->addWidget(splitter);
 
   auto tree = new QTreeView();
-  chunk_model_.SetCore(riff);
+  chunk_model_.SetTable(table);
   tree->setModel(&chunk_model_);
   tree->setContextMenuPolicy(Qt::CustomContextMenu);
   connect(tree->selectionModel(), &QItemSelectionModel::currentRowChanged, this, &SIViewDialog::SelectionChanged);
@@ -34,6 +33,7 @@ SIViewDialog::SIViewDialog(Info *riff, QWidget *parent) :
   config_stack_->addWidget(panel_);*/
 
   panel_ = new InfoPanel();
+  panel_->SetSource(table, filename);
   splitter->addWidget(panel_);
 
   splitter->setSizes({99999, 99999});
@@ -54,5 +54,9 @@ void SIViewDialog::SetSubtitle(const QString &s)
 
 void SIViewDialog::SelectionChanged(const QModelIndex &index)
 {
-  panel_->SetData(static_cast<Info*>(index.internalPointer()));
+  if (index.isValid()) {
+    panel_->SetData(const_cast<ChunkTable::Chunk*>(&table_->at(ChunkModel::GetChunkFromIndex(index))));
+  } else {
+    panel_->SetData(nullptr);
+  }
 }
@@ -12,7 +12,7 @@ class SIViewDialog : public QWidget
 {
   Q_OBJECT
 public:
-  SIViewDialog(si::Info *info, QWidget *parent = nullptr);
+  SIViewDialog(const si::ChunkTable *table, const QString &filename, QWidget *parent = nullptr);
 
   void SetSubtitle(const QString &s);
 
@@ -25,8 +25,7 @@ private:
 
   InfoPanel *panel_;
 
-  const si::Info *last_set_data_;
-  const si::Info *root_;
+  const si::ChunkTable *table_;
 
   std::unique_ptr<si::Interleaf> temp_interleaf_;
 
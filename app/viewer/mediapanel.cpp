@@ -49,6 +49,16 @@ MediaPanel::MediaPanel(QWidget *parent) :
   connect(m_PlayShortcut, &QShortcut::activated, this, [this]() { Play(!IsPlaying()); });
   ctrl_layout->addWidget(m_PlayBtn);
 
+  row++;
+
+  auto data_group = new QGroupBox(tr("Data"));
+  layout()->addWidget(data_group, row, 0, 1, 2);
+
+  auto data_layout = new QVBoxLayout(data_group);
+
+  m_DataView = new HexViewer();
+  data_layout->addWidget(m_DataView);
+
   //FinishLayout();
 
   m_PlaybackTimer = new QTimer(this);
@@ -136,7 +146,7 @@ qint64 MediaInstance::ReadAudio(char *data, qint64 maxlen)
 
 int ReadData(void *opaque, uint8_t *buf, int buf_sz)
 {
-  si::MemoryBuffer *m = static_cast<si::MemoryBuffer *>(opaque);
+  si::FileBase *m = static_cast<si::FileBase *>(opaque);
 
   int s = m->ReadData(reinterpret_cast<char*>(buf), buf_sz);
   if (s == 0) {
@@ -150,7 +160,7 @@ int ReadData(void *opaque, uint8_t *buf, int buf_sz)
 
 int64_t SeekData(void *opaque, int64_t offset, int whence)
 {
-  si::MemoryBuffer *m = static_cast<si::MemoryBuffer *>(opaque);
+  si::FileBase *m = static_cast<si::FileBase *>(opaque);
 
   if (whence == AVSEEK_SIZE) {
     return m->size();
@@ -165,6 +175,13 @@ void MediaPanel::OnOpeningData(void *data)
 {
   OpenMediaInstance(static_cast<si::Object*>(data));
 
+  if (m_DataStream.Open(static_cast<si::Object*>(data))) {
+    m_DataView->SetSource(&m_DataStream, 0, m_DataStream.size());
+  } else {
+    // Don't leave the viewer reading from a stream that didn't open
+    m_DataView->SetSource(nullptr, 0, 0);
+  }
+
   float total_duration = 0.0f;
   for (auto it=m_mediaInstances.cbegin(); it!=m_mediaInstances.cend(); it++) {
     auto m = *it;
@@ -189,6 +206,9 @@ void MediaPanel::Close()
 
   qDeleteAll(m_imgViewers);
   m_imgViewers.clear();
+
+  m_DataView->SetSource(nullptr, 0, 0);
+  m_DataStream.Close();
 }
 
 QImage MediaInstance::GetVideoFrame(float t)
@@ -344,7 +364,7 @@ void MediaPanel::OpenMediaInstance(si::Object *o)
   {
     auto m = new MediaInstance(this);
 
-    m->Open(o->ExtractToMemory());
+    m->Open(o);
     m->SetStartOffset(float(o->time_offset_) * 0.001f);
     m->SetVolume(float(o->volume_) / si::MxOb::MAXIMUM_VOLUME);
     m->SetVirtualTime(0);
@@ -558,17 +578,22 @@ MediaInstance::MediaInstance(QObject *parent) :
 {
 }
 
-void MediaInstance::Open(const si::bytearray &buf)
+void MediaInstance::Open(const si::Object *o)
 {
   static const size_t buf_sz = 4096;
 
-  m_Data = buf;
+  // Reads straight from the object's chunks rather than extracting a copy of the file
+  if (!m_Data.Open(o)) {
+    qCritical() << "Object has no data";
+    Close();
+    return;
+  }
 
   m_IoCtx = avio_alloc_context(
         (unsigned char *) av_malloc(buf_sz),
         buf_sz,
         0,
-        &m_Data,
+        static_cast<si::FileBase *>(&m_Data),
         ReadData,
         nullptr,
         SeekData
@@ -601,8 +626,7 @@ void MediaInstance::Open(const si::bytearray &buf)
   m_duration = m_Stream->duration;
   if (m_Stream->codecpar->codec_id == AV_CODEC_ID_FLIC) {
     // FFmpeg can't retrieve the FLIC duration, but we can
-    si::FLIC *flic = (si::FLIC *) buf.data();
-    m_duration = flic->frames;
+    m_duration = o->GetFileHeader().cast<si::FLIC>()->frames;
   }
 
   const AVCodec *decoder = avcodec_find_decoder(m_Stream->codecpar->codec_id);
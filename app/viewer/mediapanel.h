@@ -10,6 +10,7 @@ extern "C" {
 
 #include <file.h>
 #include <object.h>
+#include <objectstream.h>
 
 #include <QAudioFormat>
 #include <QAudioOutput>
@@ -20,6 +21,7 @@ extern "C" {
 #include <QShortcut>
 #include <QSlider>
 #include <QTimer>
+#include "hexview.h"
 #include "panel.h"
 
 class MediaInstance : public QObject
@@ -28,7 +30,7 @@ class MediaInstance : public QObject
 public:
   MediaInstance(QObject *parent = nullptr);
 
-  void Open(const si::bytearray &buf);
+  void Open(const si::Object *o);
 
   void Close();
 
@@ -103,7 +105,7 @@ private:
 
   AVIOContext *m_IoCtx;
 
-  si::MemoryBuffer m_Data;
+  si::ObjectStream m_Data;
 
   QAudioFormat m_playbackFormat;
   AVSampleFormat m_AudioOutputSampleFmt;
@@ -195,6 +197,10 @@ private:
   float m_PlaybackOffset;
   QVBoxLayout *m_viewerLayout;
 
+  // Separate from the media instances' streams so browsing doesn't move their positions
+  si::ObjectStream m_DataStream;
+  HexViewer *m_DataView;
+
 private slots:
   void Play(bool e);
 
@@ -0,0 +1,95 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "othertypes.h"
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief Converts PCM audio between sample rates, bit depths and channel counts
+ *
+ * Only uncompressed 8-bit and 16-bit PCM is supported, which is all the game uses.
+ *
+ * Audio is converted in pieces of any size, so a whole clip never has to be in memory at once.
+ * Only the few input samples the filters still need are carried from one piece to the next, and
+ * the result is the same however the input is divided up.
+ */
+class AudioConverter
+{
+public:
+  LIBWEAVER_EXPORT AudioConverter(const WAVFmt &from, const WAVFmt &to);
+
+  LIBWEAVER_EXPORT static bool IsSupported(const WAVFmt &fmt);
+
+  /// True if audio in one format has to be converted to play as the other
+  LIBWEAVER_EXPORT static bool NeedsConversion(const WAVFmt &from, const WAVFmt &to);
+
+  /**
+   * @brief Converts a whole clip from one format to another
+   *
+   * If normalize is set, the result is scaled so its loudest sample is just under full scale.
+   */
+  LIBWEAVER_EXPORT static bool Convert(const WAVFmt &from, const bytearray &in, const WAVFmt &to, bytearray *out, bool normalize = false);
+
+  /**
+   * @brief Converts the next piece of a clip, appending whatever's ready to out
+   *
+   * Pieces don't have to end on a whole sample. The output runs a few samples behind the input
+   * until Finish(). If out is NULL, the output is only measured for GetPeak().
+   */
+  LIBWEAVER_EXPORT void Convert(const char *data, size_t size, bytearray *out);
+
+  /// Appends the rest of the clip to out, then starts over for another
+  LIBWEAVER_EXPORT void Finish(bytearray *out);
+
+  /// Multiplies every output sample, such as by NormalizeGain() of a measuring pass
+  void SetGain(float gain) { gain_ = gain; }
+
+  /// Loudest output sample so far, before the gain
+  float GetPeak() const { return peak_; }
+
+  /// The gain that brings GetPeak() to just under full scale
+  LIBWEAVER_EXPORT float NormalizeGain() const;
+
+private:
+  void Reset();
+  size_t FilterStart(size_t frame) const { return (frame > half_) ? frame - half_ : 0; }
+  void Add(const char *data, size_t frames);
+  void Emit(bool finished, bytearray *out);
+  float GetFiltered(size_t frame, size_t channel, size_t end) const;
+  void Encode(const float *in, size_t count, bytearray *out);
+
+  WAVFmt from_;
+  WAVFmt to_;
+
+  // When downsampling, each input is averaged over the span of one output sample first so high
+  // frequencies don't alias back into what's left
+  bool filter_;
+  size_t width_;
+  size_t half_;
+  double step_;
+
+  float gain_;
+  float peak_;
+
+  // Bytes of a frame the last piece ended partway through
+  bytearray partial_;
+
+  // Mixed input frames from base_ onwards, and when filtering, the running sums of each channel
+  // up to each of them
+  size_t base_;
+  size_t received_;
+  std::vector<float> frames_;
+  std::vector<double> sums_;
+
+  uint64_t emitted_;
+
+  std::vector<float> decoded_;
+  std::vector<float> block_;
+
+};
+
+}
+
+#endif // AUDIO_H
@@ -0,0 +1,69 @@
+#ifndef CHUNKEDDATA_H
+#define CHUNKEDDATA_H
+
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief An object's payload, split into the chunks it's stored as
+ *
+ * Copies share the same chunks until one of them is modified, so identical payloads from
+ * different files can be held in memory once. Reading never copies, which is why chunks can only
+ * be changed through Modify().
+ */
+class ChunkedData
+{
+public:
+  typedef std::vector<bytearray>::const_iterator const_iterator;
+
+  LIBWEAVER_EXPORT ChunkedData();
+  LIBWEAVER_EXPORT ChunkedData(const ChunkedData &other);
+  LIBWEAVER_EXPORT ~ChunkedData();
+
+  LIBWEAVER_EXPORT ChunkedData &operator=(const ChunkedData &other);
+
+  size_t size() const { return m_Shared ? m_Shared->chunks.size() : 0; }
+  bool empty() const { return size() == 0; }
+
+  const bytearray &at(size_t i) const { return (m_Shared ? m_Shared->chunks : Empty()).at(i); }
+  const bytearray &operator[](size_t i) const { return m_Shared->chunks[i]; }
+  const bytearray &front() const { return m_Shared->chunks.front(); }
+  const bytearray &back() const { return m_Shared->chunks.back(); }
+
+  const_iterator begin() const { return m_Shared ? m_Shared->chunks.begin() : Empty().begin(); }
+  const_iterator end() const { return m_Shared ? m_Shared->chunks.end() : Empty().end(); }
+
+  LIBWEAVER_EXPORT void push_back(const bytearray &chunk);
+  LIBWEAVER_EXPORT void resize(size_t size);
+  LIBWEAVER_EXPORT void reserve(size_t size);
+  LIBWEAVER_EXPORT void clear();
+
+  /// Returns a chunk for modification, copying the chunks first if they're shared
+  LIBWEAVER_EXPORT bytearray &Modify(size_t i);
+
+  /// Replaces the contents with a plain vector of chunks, taking them without copying
+  LIBWEAVER_EXPORT void Assign(std::vector<bytearray> *chunks);
+
+  /// True if both hold the very same chunks in memory, not just equal ones
+  bool IsSharedWith(const ChunkedData &other) const { return m_Shared && m_Shared == other.m_Shared; }
+
+private:
+  struct Shared
+  {
+    std::vector<bytearray> chunks;
+    volatile long refs;
+  };
+
+  static const std::vector<bytearray> &Empty();
+
+  void Detach();
+  void Release();
+
+  Shared *m_Shared;
+
+};
+
+}
+
+#endif // CHUNKEDDATA_H
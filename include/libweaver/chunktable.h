@@ -0,0 +1,79 @@
+#ifndef CHUNKTABLE_H
+#define CHUNKTABLE_H
+
+#include <string>
+#include <vector>
+
+#include "file.h"
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief Every chunk of an SI file in one flat array, see Interleaf::IncludeChunkTable
+ *
+ * A much lighter alternative to the Info tree for browsing a file's structure. Chunks link to
+ * their parent and siblings by index instead of each being allocated on its own, descriptions
+ * all share one string, and chunk data isn't kept at all, only where to find it in the file.
+ * The first chunk is the RIFF chunk everything else is below.
+ */
+class ChunkTable
+{
+public:
+  /// No chunk, or no object
+  static const uint32_t NONE = 0xFFFFFFFF;
+
+  struct Chunk
+  {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t object_id;
+
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t child_count;
+
+    /// Where this is in its parent's children
+    uint32_t row;
+
+    uint32_t desc_offset;
+    uint32_t desc_size;
+  };
+
+  LIBWEAVER_EXPORT void clear();
+
+  size_t size() const { return chunks_.size(); }
+  bool empty() const { return chunks_.empty(); }
+  const Chunk &at(size_t i) const { return chunks_.at(i); }
+
+  /// Walks the parent's children, so reading them in order is cheapest done with next_sibling
+  LIBWEAVER_EXPORT uint32_t GetChild(uint32_t parent, uint32_t row) const;
+
+  LIBWEAVER_EXPORT std::string GetDescription(uint32_t i) const;
+
+  /// Only MxCh chunks carry data
+  LIBWEAVER_EXPORT bool HasData(uint32_t i) const;
+
+  /// Where a chunk's data is in the file the table was read from
+  LIBWEAVER_EXPORT uint32_t GetDataOffset(uint32_t i) const;
+  LIBWEAVER_EXPORT uint32_t GetDataSize(uint32_t i) const;
+
+  /// Reads a chunk's data from the file the table was read from
+  LIBWEAVER_EXPORT bool ReadData(FileBase *f, uint32_t i, bytearray *data) const;
+
+private:
+  friend class Interleaf;
+
+  uint32_t Append(uint32_t parent, uint32_t previous);
+  void SetDescription(uint32_t i, const std::string &d);
+
+  std::vector<Chunk> chunks_;
+  std::string descriptions_;
+
+};
+
+}
+
+#endif // CHUNKTABLE_H
@@ -17,6 +17,7 @@ public:
   typedef std::vector<Core*> Children;
 
   LIBWEAVER_EXPORT Core *GetParent() const { return parent_; }
+  LIBWEAVER_EXPORT Core *GetRoot();
   LIBWEAVER_EXPORT const Children &GetChildren() const { return children_; }
 
   bool FindParent(Core *p) const;
@@ -30,19 +31,29 @@ public:
   LIBWEAVER_EXPORT Core *GetChildAt(size_t index) const { return children_.at(index); }
   LIBWEAVER_EXPORT size_t GetChildCount() const { return children_.size(); }
   LIBWEAVER_EXPORT bool HasChildren() const { return !children_.empty(); }
-  LIBWEAVER_EXPORT bool ContainsChild(Core *child) const { return std::find(children_.begin(), children_.end(), child) != children_.end(); }
+  LIBWEAVER_EXPORT bool ContainsChild(Core *child) const { return child->parent_ == this; }
 
 protected:
   void DeleteChildren();
 
+  // Called on the root of a tree whenever a child joins or leaves anywhere in it. Everything
+  // below the child comes and goes with it.
+  virtual void OnDescendantAdded(Core *child) {}
+  virtual void OnDescendantRemoved(Core *child) {}
+
 private:
   // Disable copy
   Core(const Core& other);
   Core& operator=(const Core& other);
 
+  void UpdateChildIndexes(size_t from);
+
   Core *parent_;
   Children children_;
 
+  // Where this is in the parent's children, kept up to date so lookups don't have to search
+  size_t index_;
+
 };
 
 }
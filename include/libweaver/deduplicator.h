@@ -0,0 +1,70 @@
+#ifndef DEDUPLICATOR_H
+#define DEDUPLICATOR_H
+
+#include "interleaf.h"
+#include "object.h"
+
+namespace si {
+
+struct DuplicateReport
+{
+  struct Asset
+  {
+    /// Index into the list of files that was searched
+    size_t file;
+    Object *object;
+  };
+
+  struct Group
+  {
+    uint64_t hash;
+
+    /// Size of one copy
+    uint64_t size;
+
+    std::vector<Asset> assets;
+  };
+
+  /// Every payload that appears more than once, largest total waste first
+  std::vector<Group> groups;
+
+  /// Bytes taken up by copies beyond the first of each payload
+  uint64_t duplicate_bytes;
+};
+
+/**
+ * @brief Finds objects with identical payloads, across any number of files
+ *
+ * Payloads only match if they're split into chunks the same way, since that's what lets them
+ * share memory. Matches are confirmed byte for byte, so hash collisions can't merge different
+ * payloads.
+ */
+class Deduplicator
+{
+public:
+  /// Fast non-cryptographic 64-bit hash (the XXH64 algorithm)
+  LIBWEAVER_EXPORT static uint64_t Hash(const void *data, size_t size, uint64_t seed = 0);
+
+  /// Hash of an object's chunks, including where the chunk boundaries fall
+  LIBWEAVER_EXPORT static uint64_t Hash(const ChunkedData &data);
+
+  LIBWEAVER_EXPORT static void FindDuplicates(const std::vector<Interleaf*> &files, DuplicateReport *report, size_t threads = 0);
+
+  /**
+   * @brief Makes every copy in each group share the first one's chunks
+   *
+   * Returns the number of bytes freed. Modifying a shared object later gives it its own copy
+   * again, so nothing else changes.
+   */
+  LIBWEAVER_EXPORT static uint64_t Share(const DuplicateReport &report);
+
+private:
+  static void CollectObjects(Core *parent, size_t file, std::vector<DuplicateReport::Asset> *assets);
+  static bool IsEqual(const ChunkedData &a, const ChunkedData &b);
+  static uint64_t GetSize(const ChunkedData &data);
+
+};
+
+}
+
+#endif // DEDUPLICATOR_H
@@ -0,0 +1,90 @@
+#ifndef EXTRACTOR_H
+#define EXTRACTOR_H
+
+#include <string>
+
+#include "core.h"
+#include "object.h"
+
+namespace si {
+
+struct ExtractReport
+{
+  enum Reason
+  {
+    /// The directory couldn't be created, nothing below it was extracted
+    DirectoryFailed,
+
+    /// The file couldn't be created or written in full
+    FileFailed
+  };
+
+  struct Error
+  {
+    Reason reason;
+    std::string path;
+
+    /// NULL for directories
+    const Object *object;
+  };
+
+  std::vector<Error> errors;
+
+  size_t files;
+  uint64_t bytes;
+};
+
+/**
+ * @brief Extracts every object in a tree of objects into matching directories
+ *
+ * Each object with data is written to its filename, without the original directory, and each
+ * object with children gets a directory of its own name for them, as the app's Extract All always
+ * has. Objects without a filename are written as their name plus ".bin", as the app already names
+ * them when extracting a single object, where Extract All used to fail. Objects that share a
+ * path are written in tree order, so the last one wins. Files are written on a pool of threads,
+ * each streaming straight from the object's chunks through one reused buffer.
+ */
+class Extractor
+{
+public:
+  struct Target
+  {
+    const Core *root;
+
+    /// UTF-8 path of the directory to extract into, created if it doesn't exist
+    std::string directory;
+  };
+
+  /// Extracts several trees at once, such as every SI file of the game, in one pool
+  LIBWEAVER_EXPORT static void ExtractAll(const std::vector<Target> &targets, ExtractReport *report, size_t threads = 0);
+
+  LIBWEAVER_EXPORT static void ExtractAll(const Core *root, const std::string &directory, ExtractReport *report, size_t threads = 0);
+
+  /// The filename an object is extracted as
+  LIBWEAVER_EXPORT static std::string GetFilename(const Object *object);
+
+private:
+  friend class ExtractJob;
+
+  struct Item
+  {
+    const Object *object;
+    std::string path;
+    uint64_t size;
+  };
+
+  /// Items with the same path, which have to be written one at a time
+  struct Group
+  {
+    std::vector<size_t> items;
+    uint64_t size;
+  };
+
+  static void CollectItems(const Core *parent, const std::string &directory, std::vector<Item> *items, ExtractReport *report);
+  static bool WriteItem(const Item &item, bytearray *buffer);
+
+};
+
+}
+
+#endif // EXTRACTOR_H
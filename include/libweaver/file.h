@@ -18,7 +18,10 @@ public:
 
   enum Mode {
     Read,
-    Write
+    Write,
+
+    /// Opens an existing file for modification without truncating it
+    ReadWrite
   };
 
   typedef uint64_t pos_t;
@@ -79,7 +82,41 @@ public:
   virtual pos_t ReadData(void *data, pos_t size);
   virtual pos_t WriteData(const void *data, pos_t size);
 
+  struct Range
+  {
+    pos_t source;
+    pos_t destination;
+    pos_t size;
+  };
+
+  /**
+   * @brief Copies byte ranges from one file into another that already exists
+   *
+   * Where the system supports it, the data is cloned or copied inside the kernel so that
+   * filesystems like btrfs and XFS can share it between both files instead of duplicating it.
+   * Otherwise it's read and written normally.
+   */
+  static bool CopyRanges(const char *source, const char *destination, const std::vector<Range> &ranges);
+
+#ifdef _WIN32
+  static bool CopyRanges(const wchar_t *source, const wchar_t *destination, const std::vector<Range> &ranges);
+#endif
+
+  /**
+   * @brief Checks whether two paths lead to the same file on disk
+   *
+   * Compares the files themselves rather than the paths, so relative paths, symlinks and hard
+   * links are all caught. Returns false if either file doesn't exist.
+   */
+  static bool IsSameFile(const char *a, const char *b);
+
+#ifdef _WIN32
+  static bool IsSameFile(const wchar_t *a, const wchar_t *b);
+#endif
+
 private:
+  static bool CopyRangesWithFiles(File *source, File *destination, const std::vector<Range> &ranges, size_t start);
+
   void *m_Handle;
   Mode m_Mode;
 
@@ -0,0 +1,80 @@
+#ifndef FLIC_H
+#define FLIC_H
+
+#include "file.h"
+#include "quantizer.h"
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief Decodes FLIC animations and encodes them into the chunks SI stores them as
+ *
+ * The first chunk is the 128-byte FLC header. Every chunk after it is one frame, preceded by a
+ * 20-byte header holding the number of rectangles that changed (always 1) and the rectangle
+ * itself. Frames that don't change anything are stored as that header alone.
+ */
+class FlicCodec
+{
+public:
+  struct Frame
+  {
+    /// One palette index per pixel, top row first
+    bytearray pixels;
+
+    PaletteQuantizer::Palette palette;
+  };
+
+  struct Animation
+  {
+    uint16_t width;
+    uint16_t height;
+
+    /// Milliseconds between frames
+    uint32_t speed;
+
+    std::vector<Frame> frames;
+  };
+
+  /// Reads a whole FLI or FLC file into full frames
+  LIBWEAVER_EXPORT static bool Decode(FileBase *f, Animation *animation);
+
+  /**
+   * @brief Encodes an animation into SI's FLC chunks
+   *
+   * Each frame is stored as the difference from the one before it, using whichever of DELTA_FLC
+   * and BYTE_RUN is smaller, with COLOR_256 for any palette changes. Frames are encoded in
+   * parallel since each only depends on its predecessor's pixels.
+   */
+  LIBWEAVER_EXPORT static bool Encode(const Animation &animation, std::vector<bytearray> *chunks, size_t threads = 0);
+
+  static const size_t kCustomHeaderSize = 20;
+
+private:
+  friend class FlicEncodeJob;
+
+  enum ChunkType
+  {
+    COLOR_256 = 4,
+    DELTA_FLC = 7,
+    COLOR_64 = 11,
+    DELTA_FLI = 12,
+    BLACK = 13,
+    BYTE_RUN = 15,
+    FLI_COPY = 16,
+
+    FRAME_TYPE = 0xF1FA
+  };
+
+  static bool DecodeFrame(const bytearray &data, uint16_t width, uint16_t height, Frame *frame);
+  static bytearray EncodeFrame(const Animation &animation, size_t index);
+
+  static void EncodePalette(const PaletteQuantizer::Palette *previous, const PaletteQuantizer::Palette &palette, MemoryBuffer *out);
+  static void EncodeByteRun(const Animation &animation, const Frame &frame, MemoryBuffer *out);
+  static void EncodeDelta(const Animation &animation, const Frame &previous, const Frame &frame, MemoryBuffer *out);
+
+};
+
+}
+
+#endif // FLIC_H
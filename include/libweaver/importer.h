@@ -0,0 +1,50 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <string>
+
+#include "core.h"
+#include "object.h"
+
+namespace si {
+
+struct ImportReport
+{
+  struct Result
+  {
+    Object *object;
+
+    /// UTF-8 path of the file that matched the object
+    std::string path;
+
+    bool replaced;
+  };
+
+  /// One result for every object a file was found for
+  std::vector<Result> results;
+
+  size_t replaced;
+  size_t failed;
+};
+
+/**
+ * @brief Replaces objects from a directory laid out the way Extractor writes one
+ *
+ * Files are matched to objects by the same name and filename rules Extractor uses, and objects
+ * without a file are left alone. Every file is parsed and chunked in parallel first, and only
+ * once they're all done are the objects updated, so the tree never holds a mix of old and
+ * half-converted data.
+ */
+class Importer
+{
+public:
+  LIBWEAVER_EXPORT static void ReplaceAll(Core *root, const std::string &directory, ImportReport *report, int flags = Object::DefaultReplaceFlags, size_t threads = 0);
+
+private:
+  static void CollectMatches(Core *parent, const std::string &directory, ImportReport *report);
+
+};
+
+}
+
+#endif // IMPORTER_H
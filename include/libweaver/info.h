@@ -2,6 +2,7 @@
 #define INFO_H
 
 #include "core.h"
+#include "file.h"
 
 namespace si {
 
@@ -13,6 +14,8 @@ public:
   Info()
   {
     m_ObjectID = NULL_OBJECT_ID;
+    m_DataOffset = 0;
+    m_DataSize = 0;
   }
 
   void clear()
@@ -36,8 +39,38 @@ public:
   const std::string &GetDescription() const { return m_Desc; }
   void SetDescription(const std::string &d) { m_Desc = d; }
 
-  const bytearray &GetData() const { return m_Data; }
-  void SetData(const bytearray &d) { m_Data = d; }
+  // Only where the data is in the file is kept, it's read from there when it's wanted
+  const uint32_t &GetDataOffset() const { return m_DataOffset; }
+  const uint32_t &GetDataSize() const { return m_DataSize; }
+  bool HasData() const { return m_DataSize > 0; }
+  void SetDataLocation(uint32_t offset, uint32_t size)
+  {
+    m_DataOffset = offset;
+    m_DataSize = size;
+  }
+
+  bool ReadData(FileBase *f, bytearray *data) const
+  {
+    data->resize(m_DataSize);
+    if (!m_DataSize) {
+      return true;
+    }
+    f->seek(m_DataOffset, FileBase::SeekStart);
+    return f->ReadData(data->data(), m_DataSize) == m_DataSize;
+  }
+
+  /**
+   * @brief The data, read from the file it came from
+   *
+   * @deprecated Kept for code written when Info held the data itself, use ReadData() to reuse a
+   * buffer and see whether the read failed. SetData() is gone, use SetDataLocation().
+   */
+  bytearray GetData(FileBase *f) const
+  {
+    bytearray data;
+    ReadData(f, &data);
+    return data;
+  }
 
 private:
   uint32_t m_Type;
@@ -45,7 +78,8 @@ private:
   uint32_t m_Size;
   uint32_t m_ObjectID;
   std::string m_Desc;
-  bytearray m_Data;
+  uint32_t m_DataOffset;
+  uint32_t m_DataSize;
 
 };
 
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <map>
 
+#include "chunktable.h"
 #include "core.h"
 #include "file.h"
 #include "info.h"
@@ -11,6 +12,56 @@
 
 namespace si {
 
+/**
+ * @brief Where everything would land in a written SI file, see Interleaf::PlanLayout()
+ */
+struct LayoutReport
+{
+  struct Placement
+  {
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  /// Where an MxCh would be, enough to replay the file with Simulator without writing it
+  struct ChunkPlacement
+  {
+    uint32_t object;
+    uint32_t time;
+    uint16_t flags;
+
+    /// Where its data ends
+    uint32_t end;
+
+    /// False for the pieces of a split chunk before its last one
+    bool complete;
+  };
+
+  /// Total size of the file
+  uint64_t file_size;
+
+  uint32_t buffer_size;
+  uint32_t buffer_count;
+
+  /// Every MxSt, identified by its top-level object's ID
+  std::vector<Placement> streams;
+
+  /// Every MxOb, including sub-objects
+  std::vector<Placement> objects;
+
+  /// Bytes taken up by pad_ chunks, including their headers
+  uint64_t padding_bytes;
+  uint32_t padding_chunks;
+
+  /// Number of MxCh chunks, and how many of those are pieces of a split chunk
+  uint32_t chunks;
+  uint32_t split_chunks;
+
+  /// Every MxCh in the order it would be written
+  std::vector<ChunkPlacement> chunk_placements;
+};
+
 class Interleaf : public Core
 {
 public:
@@ -32,7 +83,20 @@ public:
   {
     IncludeData = 1,
     IncludeInfo = 2,
-    ObjectsOnly = 4
+    ObjectsOnly = 4,
+
+    /// Build a ChunkTable, a compact alternative to IncludeInfo that doesn't need IncludeData
+    IncludeChunkTable = 8
+  };
+
+  enum WriteFlags
+  {
+    /// Serialize top-level streams on all cores. Output is identical to a serial write.
+    WriteParallel = 1,
+
+    /// Split chunks at buffer boundaries whenever possible instead of padding, and reorder chunks
+    /// due at the same time so they fill buffers more tightly. Produces smaller files.
+    WriteMinimizePadding = 2
   };
 
   LIBWEAVER_EXPORT Interleaf();
@@ -40,46 +104,188 @@ public:
   LIBWEAVER_EXPORT void Clear();
 
   LIBWEAVER_EXPORT Error Read(const char *f, int flags = IncludeData | IncludeInfo);
-  LIBWEAVER_EXPORT Error Write(const char *f) const;
+  /**
+   * @brief Writes the whole file
+   *
+   * Afterwards every stream counts as unmodified, and where each one went is remembered so
+   * WriteModified() and WriteCopyingUnchanged() can build on this file later. Writing from a
+   * const Interleaf produces the same file but remembers nothing.
+   */
+  LIBWEAVER_EXPORT Error Write(const char *f, int flags = 0);
+  LIBWEAVER_EXPORT Error Write(const char *f, int flags = 0) const;
+
+  /**
+   * @brief Writes only the streams that have been modified since the last read or write
+   *
+   * The file must be the one this Interleaf was last read from or written to. Modified
+   * streams are rewritten in place if they still fit, otherwise they're moved to the end of
+   * the file. Falls back to a full write if the file's layout isn't known.
+   *
+   * A stream only counts as modified once something in it has gone through a setter,
+   * ReplaceWithFile() or MarkModified(). Changes made straight to an object's members are
+   * skipped unless MarkModified() is called afterwards.
+   */
+  LIBWEAVER_EXPORT Error WriteModified(const char *f);
+
+  /**
+   * @brief Writes a new file, copying unmodified streams from the file they came from
+   *
+   * The source must be the file this Interleaf was last read from or written to. Streams that
+   * haven't changed and still land in the same place relative to buffer boundaries are copied
+   * from it directly, which on filesystems with reflinks shares their data instead of duplicating
+   * it. Saving over the source itself, by whatever path or link, is the same as WriteModified(),
+   * and changes are detected the same way.
+   */
+  LIBWEAVER_EXPORT Error WriteCopyingUnchanged(const char *f, const char *source, int flags = 0);
 
 #ifdef _WIN32
   LIBWEAVER_EXPORT Error Read(const wchar_t *f, int flags = IncludeData | IncludeInfo);
-  LIBWEAVER_EXPORT Error Write(const wchar_t *f) const;
+  LIBWEAVER_EXPORT Error Write(const wchar_t *f, int flags = 0);
+  LIBWEAVER_EXPORT Error Write(const wchar_t *f, int flags = 0) const;
+  LIBWEAVER_EXPORT Error WriteModified(const wchar_t *f);
+  LIBWEAVER_EXPORT Error WriteCopyingUnchanged(const wchar_t *f, const wchar_t *source, int flags = 0);
 #endif
 
   Error Read(FileBase *is, int flags = IncludeData | IncludeInfo);
-  Error Write(FileBase *os) const;
+  Error Write(FileBase *os, int flags = 0);
+  Error Write(FileBase *os, int flags = 0) const;
+
+  // The file has to be open for reading and writing. Unlike writing by filename, there's no way
+  // to truncate it here, so this fails instead if the layout isn't known.
+  Error WriteModified(FileBase *f);
 
   Info *GetInformation() { return &m_Info; }
+  const ChunkTable &GetChunkTable() const { return m_ChunkTable; }
+
+  /**
+   * @brief Works out exactly what Write() would produce without writing or copying anything
+   *
+   * Takes the same flags as Write(), so layouts can be compared before committing to one.
+   */
+  LIBWEAVER_EXPORT Error PlanLayout(LayoutReport *report, int flags = 0) const;
+
+  uint32_t GetVersion() const { return m_Version; }
+  void SetVersion(uint32_t v) { m_Version = v; }
+
+  /**
+   * @brief Size of each buffer the file is read in, chunks never cross a boundary between two
+   *
+   * Where streams are in the last file read or written only holds for the size it was written
+   * with, so while this is different the next save has to write everything.
+   */
+  uint32_t GetBufferSize() const { return m_BufferSize; }
+  void SetBufferSize(uint32_t size) { m_BufferSize = size; }
+
+  uint32_t GetBufferCount() const { return m_BufferCount; }
+  void SetBufferCount(uint32_t count) { m_BufferCount = count; }
+
+  bool HasStreamLayout() const { return !m_StreamLayout.empty() && m_StreamLayout.size() == GetChildCount() && m_StreamLayoutBufferSize == m_BufferSize; }
+
+  /**
+   * @brief The object with this ID anywhere in the file, or NULL if there isn't one
+   *
+   * Objects are indexed as they're added to or removed from the tree, so this is a lookup in a
+   * sorted index (logarithmic in the number of objects) rather than a search of the tree. Change
+   * IDs with SetObjectID() to keep the index in step. Null objects, such as placeholders that
+   * haven't been read yet, aren't indexed.
+   */
+  LIBWEAVER_EXPORT Object *GetObjectByID(uint32_t id) const;
+
+  /// As above, also setting shared if more than one object has this ID
+  LIBWEAVER_EXPORT Object *GetObjectByID(uint32_t id, bool *shared) const;
+
+  /// Fills path with the objects from the top-level stream down to the one with this ID
+  LIBWEAVER_EXPORT bool GetObjectPath(uint32_t id, std::vector<Object*> *path) const;
+
+  LIBWEAVER_EXPORT void SetObjectID(Object *o, uint32_t id);
+
+protected:
+  virtual void OnDescendantAdded(Core *child);
+  virtual void OnDescendantRemoved(Core *child);
 
 private:
-  Error ReadChunk(Core *parent, FileBase *f, Info *info);
+  struct StreamSpan
+  {
+    // Where this object's MxSt begins, or 0 if it doesn't have one
+    uint32_t offset;
+
+    // Where its MxSt ends
+    uint32_t end;
+
+    // Where the next stream begins, anything between end and here is padding
+    uint32_t limit;
+  };
+
+  // Where a full write put everything, kept by RecordLayout() once the file is saved
+  struct WrittenLayout
+  {
+    std::vector<StreamSpan> streams;
+    uint32_t offset_table_pos;
+    uint32_t stream_list_pos;
+    uint32_t stream_list_end;
+  };
+
+  void ReadStreamLayout(FileBase *f);
+
+  Error ReadChunk(Core *parent, FileBase *f, Info *info, uint32_t chunk);
 
   Object *ReadObject(FileBase *f, Object *o, std::ostream &desc);
-  void WriteObject(FileBase *f, const Object *o) const;
 
-  void InterleaveObjects(FileBase *f, const std::vector<Object*> &objects) const;
+  void IndexObjects(Core *c);
+  void UnindexObjects(Core *c);
+  void ReindexObject(Object *o, uint32_t old_id);
+  void EraseFromIndex(Object *o, uint32_t id);
 
-  void WriteSubChunk(FileBase *f, uint16_t flags, uint32_t object, uint32_t time, const bytearray &data = bytearray()) const;
-  void WriteSubChunkInternal(FileBase *f, uint16_t flags, uint32_t object, uint32_t time, uint32_t data_sz, const bytearray &data) const;
+  void UpdateDiskSizes() const;
+  uint32_t GetCopyableStreamSize(size_t i, uint32_t offset) const;
+  Error WriteWithCopies(FileBase *f, int flags, std::vector<File::Range> *copies, WrittenLayout *layout, LayoutReport *report = NULL) const;
+  void RecordLayout(WrittenLayout *layout);
+  struct WriteScratch;
+  struct ScheduledChunk;
 
-  void WritePadding(FileBase *f, uint32_t size) const;
-  void WritePaddingIfNecessary(FileBase *f, size_t projectedWrite) const;
+  void WriteStream(FileBase *f, const Object *o, WriteScratch *scratch) const;
+  void WriteObject(FileBase *f, const Object *o, LayoutReport *report) const;
+
+  void InterleaveObjects(FileBase *f, WriteScratch *scratch) const;
+  void WriteScheduledChunk(FileBase *f, WriteScratch *scratch, const ScheduledChunk &chunk) const;
+
+  void WriteSubChunk(FileBase *f, WriteScratch *scratch, uint16_t flags, uint32_t object, uint32_t time, const bytearray &data) const;
+  void WriteSubChunkInternal(FileBase *f, LayoutReport *report, uint16_t flags, uint32_t object, uint32_t time, uint32_t data_sz, const char *data, size_t size) const;
+
+  void WritePadding(FileBase *f, uint32_t size, LayoutReport *report = NULL) const;
+  void WritePaddingIfNecessary(FileBase *f, size_t projectedWrite, LayoutReport *report = NULL) const;
+  bool CanPadTo(uint32_t pos, uint32_t target) const;
+  void WritePaddingTo(FileBase *f, uint32_t target) const;
 
   Info m_Info;
+  ChunkTable m_ChunkTable;
 
   uint32_t m_Version;
   uint32_t m_BufferSize;
   uint32_t m_BufferCount;
 
   std::map<uint32_t, Object*> m_ObjectOffsetTable;
-  std::map<uint32_t, Object*> m_ObjectIDTable;
+
+  // Every object in the tree by ID, kept up to date by OnDescendantAdded() and OnDescendantRemoved()
+  // Objects are only indexed once they've been read. IDs should be unique, but nothing stops two
+  // objects sharing one, so each object gets its own entry.
+  typedef std::multimap<uint32_t, Object*> ObjectIndex;
+  ObjectIndex m_ObjectIDTable;
+
+  std::vector<StreamSpan> m_StreamLayout;
+  uint32_t m_StreamLayoutBufferSize;
+  uint32_t m_OffsetTablePos;
+  uint32_t m_OffsetTableCount;
+  uint32_t m_StreamListPos;
+  uint32_t m_StreamListEnd;
 
   uint32_t m_JoiningProgress;
   uint32_t m_JoiningSize;
 
   int m_readFlags;
 
+  friend class SerializeStreamsJob;
+
 };
 
 }
@@ -1,18 +1,71 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include "chunkeddata.h"
 #include "core.h"
 #include "sitypes.h"
 #include "types.h"
 
 namespace si {
 
+class WAVFmt;
+
+/**
+ * @brief Decides how much media goes into each chunk when replacing an object's data
+ *
+ * Audio is the only type with a choice, Smacker frames and bitmap bodies are each one chunk
+ * because that's how they're presented. With a buffer size, audio chunks are sized so a whole
+ * number of them fill a buffer, rather than leaving the writer to split or pad around them.
+ */
+class ChunkingPolicy
+{
+public:
+  /**
+   * A buffer size of 0 gives one second of audio per chunk. Threads are used for re-encoding
+   * animations and quantizing bitmaps, 0 uses Parallel::GetDefaultThreadCount(). Pass 1 when
+   * already running on a pool of threads so they don't each start another.
+   */
+  LIBWEAVER_EXPORT ChunkingPolicy(uint32_t buffer_size = 0, size_t threads = 0);
+
+  /// Bytes of audio per chunk, always a whole number of samples and milliseconds
+  LIBWEAVER_EXPORT size_t GetAudioChunkSize(const WAVFmt &fmt) const;
+
+  uint32_t buffer_size() const { return buffer_size_; }
+  size_t threads() const { return threads_; }
+
+private:
+  uint32_t buffer_size_;
+  size_t threads_;
+
+};
+
 class Object : public Core
 {
 public:
-  typedef std::vector<bytearray> ChunkedData;
+  typedef si::ChunkedData ChunkedData;
+
+  enum ReplaceFlags
+  {
+    /// Convert audio to the sample rate, bit depth and channel count the object already had
+    ConformAudio = 1,
+
+    /// Scale audio so its loudest sample is just under full scale
+    NormalizeAudio = 2,
+
+    /// Quantize 24-bit and 32-bit bitmaps down to the 8-bit paletted ones the game needs
+    ConformBitmap = 4,
+
+    /// Dither bitmaps while quantizing them
+    DitherBitmap = 8,
+
+    /// Quantize bitmaps to the palette the object already had instead of building a new one
+    KeepBitmapPalette = 16,
+
+    DefaultReplaceFlags = ConformAudio | ConformBitmap
+  };
 
   Object();
+  LIBWEAVER_EXPORT virtual ~Object();
 
 #if defined(_WIN32)
   LIBWEAVER_EXPORT bool ReplaceWithFile(const wchar_t *f);
@@ -23,8 +76,15 @@ public:
   LIBWEAVER_EXPORT bool ExtractToFile(const char *f) const;
 
   LIBWEAVER_EXPORT bool ReplaceWithFile(FileBase *f);
+  LIBWEAVER_EXPORT bool ReplaceWithFile(FileBase *f, const ChunkingPolicy &policy, int flags = DefaultReplaceFlags);
   LIBWEAVER_EXPORT bool ExtractToFile(FileBase *f) const;
 
+  /// Policy for the buffer size of the Interleaf this object is in, if any
+  LIBWEAVER_EXPORT ChunkingPolicy GetChunkingPolicy() const;
+
+  /// Re-divides data that's already loaded, e.g. after the buffer size has changed
+  LIBWEAVER_EXPORT bool Rechunk(const ChunkingPolicy &policy);
+
   LIBWEAVER_EXPORT bytearray ExtractToMemory() const;
 
   LIBWEAVER_EXPORT const bytearray &GetFileHeader() const;
@@ -38,9 +98,32 @@ public:
   const std::string &filename() const { return filename_; }
   const ChunkedData &data() const { return data_; }
 
-  size_t CalculateMaximumDiskSize() const;
-
-  Object *FindSubObjectWithID(uint32_t id);
+  LIBWEAVER_EXPORT void SetExtra(const bytearray &extra);
+  LIBWEAVER_EXPORT void SetLocation(const Vector3 &location);
+  LIBWEAVER_EXPORT void SetUp(const Vector3 &up);
+  LIBWEAVER_EXPORT void SetTimeOffset(uint32_t time_offset);
+
+  // Flags the top-level stream this object belongs to as needing to be rewritten. Call this
+  // after modifying any of the members below directly.
+  LIBWEAVER_EXPORT void MarkModified();
+  bool IsModified() const { return modified_; }
+  void ClearModified() { modified_ = false; }
+
+  /**
+   * @brief Bytes this object and everything below it take up in the MxOb chunks of a file
+   *
+   * Each object keeps its result until it or something below it changes through a setter,
+   * MarkModified(), or children being added or removed, so asking again is free.
+   */
+  LIBWEAVER_EXPORT size_t GetMaximumDiskSize() const;
+  size_t CalculateMaximumDiskSize() const { return GetMaximumDiskSize(); }
+
+  // Forgets the kept size of this object and its parents. MarkModified() does this already.
+  void InvalidateDiskSize();
+
+  // Uses the ID index of the Interleaf this object is in, and only searches if it isn't in one or
+  // the ID is shared
+  LIBWEAVER_EXPORT Object *FindSubObjectWithID(uint32_t id);
 
   MxOb::Type type_;
   std::string presenter_;
@@ -69,6 +152,20 @@ public:
   ChunkedData data_;
 
 private:
+  size_t CalculateOwnDiskSize() const;
+
+  Object *SearchSubObjectWithID(uint32_t id);
+
+protected:
+  virtual void OnDescendantAdded(Core *child);
+  virtual void OnDescendantRemoved(Core *child);
+
+private:
+
+  bool modified_;
+
+  mutable size_t disk_size_;
+  mutable bool disk_size_dirty_;
 
 };
 
@@ -0,0 +1,59 @@
+#ifndef OBJECTSTREAM_H
+#define OBJECTSTREAM_H
+
+#include "file.h"
+#include "object.h"
+
+namespace si {
+
+/**
+ * @brief Reads an object's data as the file Object::ExtractToFile() would write, without copying it
+ *
+ * The stream is a list of segments pointing straight into the object's chunks, with only the
+ * framing ExtractToFile() adds (WAV and BMP headers, FLC empty frames) held separately. The
+ * object's data must not change while the stream is open.
+ */
+class ObjectStream : public FileBase
+{
+public:
+  struct Segment
+  {
+    const char *data;
+    size_t size;
+  };
+
+  LIBWEAVER_EXPORT ObjectStream();
+  LIBWEAVER_EXPORT ObjectStream(const Object *object);
+
+  LIBWEAVER_EXPORT bool Open(const Object *object);
+  LIBWEAVER_EXPORT virtual void Close();
+
+  LIBWEAVER_EXPORT virtual pos_t pos();
+  LIBWEAVER_EXPORT virtual pos_t size();
+  LIBWEAVER_EXPORT virtual void seek(pos_t p, SeekMode s = SeekStart);
+
+  LIBWEAVER_EXPORT virtual pos_t ReadData(void *data, pos_t size);
+
+  /// Read-only, always writes nothing
+  LIBWEAVER_EXPORT virtual pos_t WriteData(const void *data, pos_t size);
+
+  const std::vector<Segment> &segments() const { return m_Segments; }
+
+private:
+  void AddSegment(const char *data, size_t size);
+  void AddSegment(const bytearray &data);
+  const bytearray &AddFraming(const bytearray &data);
+
+  std::vector<Segment> m_Segments;
+  std::vector<pos_t> m_Offsets;
+  std::vector<bytearray> m_Framing;
+
+  pos_t m_Position;
+  pos_t m_Size;
+  size_t m_Current;
+
+};
+
+}
+
+#endif // OBJECTSTREAM_H
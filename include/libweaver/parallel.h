@@ -0,0 +1,41 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief Work that can be split into independent numbered tasks
+ *
+ * Run() is called once for every index, possibly from several threads at once, so it must only
+ * touch state belonging to that index.
+ */
+class ParallelJob
+{
+public:
+  virtual ~ParallelJob()
+  {
+  }
+
+  virtual void Run(size_t index) = 0;
+};
+
+class Parallel
+{
+public:
+  /// Number of threads used when none is specified, usually the number of CPU cores
+  LIBWEAVER_EXPORT static size_t GetDefaultThreadCount();
+
+  /**
+   * @brief Runs job->Run() for every index in [0, count) and returns when all have finished
+   *
+   * The calling thread takes part in the work. Passing 0 threads uses GetDefaultThreadCount().
+   */
+  LIBWEAVER_EXPORT static void Run(ParallelJob *job, size_t count, size_t threads = 0);
+
+};
+
+}
+
+#endif // PARALLEL_H
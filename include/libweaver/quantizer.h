@@ -0,0 +1,73 @@
+#ifndef QUANTIZER_H
+#define QUANTIZER_H
+
+#include "file.h"
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief Reduces true-color images to the 256-color paletted bitmaps the game uses
+ *
+ * Palettes are built with median cut over a color histogram and then refined with a few rounds
+ * of k-means. One palette can be built for a whole batch of images so they all share it, or a
+ * fixed palette such as the game's can be used instead.
+ */
+class PaletteQuantizer
+{
+public:
+  struct Color
+  {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+  };
+
+  typedef std::vector<Color> Palette;
+
+  struct Image
+  {
+    uint32_t width;
+    uint32_t height;
+
+    /// 3 bytes per pixel in RGB order, top row first
+    std::vector<uint8_t> rgb;
+  };
+
+  struct Settings
+  {
+    LIBWEAVER_EXPORT Settings();
+
+    /// Number of colors to build a palette of, at most 256
+    size_t colors;
+
+    /// Use Floyd-Steinberg dithering when mapping pixels to the palette
+    bool dither;
+
+    /// Use this palette instead of building one if it isn't empty
+    Palette fixed_palette;
+
+    /// Threads to use, or 0 for Parallel::GetDefaultThreadCount()
+    size_t threads;
+  };
+
+  /// Reads an uncompressed 24-bit or 32-bit BMP
+  LIBWEAVER_EXPORT static bool ReadBMP(FileBase *f, Image *image);
+
+  /// Builds one palette that suits every image in the batch
+  LIBWEAVER_EXPORT static Palette BuildPalette(const std::vector<const Image*> &images, const Settings &settings);
+
+  /// Picks the palette index for every pixel, top row first
+  LIBWEAVER_EXPORT static void Remap(const Image &image, const Palette &palette, const Settings &settings, bytearray *indices);
+
+  /// Writes an 8-bit BMP that Object::ReplaceWithFile() accepts for bitmap objects
+  LIBWEAVER_EXPORT static void WriteBMP(FileBase *f, uint32_t width, uint32_t height, const Palette &palette, const bytearray &indices);
+
+  /// Quantizes an image on its own and writes it as an 8-bit BMP
+  LIBWEAVER_EXPORT static void Convert(const Image &image, const Settings &settings, FileBase *f);
+
+};
+
+}
+
+#endif // QUANTIZER_H
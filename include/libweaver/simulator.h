@@ -0,0 +1,118 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "file.h"
+#include "interleaf.h"
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief Results of replaying an SI file as if it was being streamed from a CD
+ *
+ * Times are in milliseconds from when the drive was asked for the stream. Lateness is how long
+ * after its time a chunk finished arriving, so anything above 0 is an underrun.
+ */
+struct SimulationReport
+{
+  struct ObjectResult
+  {
+    uint32_t id;
+    uint32_t chunks;
+    uint32_t underruns;
+    double worst_lateness;
+  };
+
+  struct Occupancy
+  {
+    double time;
+    uint32_t buffers;
+  };
+
+  struct StreamResult
+  {
+    /// Offset of this stream's MxSt
+    uint32_t offset;
+
+    /// ID of the stream's top-level object
+    uint32_t id;
+
+    /// When the first buffer arrived and playback started
+    double start_time;
+
+    /// How long the drive spent waiting for a free buffer
+    double stall_time;
+
+    uint32_t underruns;
+    double worst_lateness;
+
+    /// Number of buffers holding data after every change
+    std::vector<Occupancy> occupancy;
+  };
+
+  std::vector<StreamResult> streams;
+  std::vector<ObjectResult> objects;
+
+  uint32_t underruns;
+  double worst_lateness;
+};
+
+class Simulator
+{
+public:
+  /// Read rate of a 1x CD-ROM drive in bytes per second
+  static const uint32_t kSingleSpeedRate = 153600;
+
+  struct Settings
+  {
+    Settings()
+    {
+      drive_speed = 2;
+      seek_time = 200.0;
+      buffer_count = 0;
+    }
+
+    /// Multiple of a 1x drive's speed, e.g. 2 for 2x
+    double drive_speed;
+
+    /// Milliseconds to seek to the start of a stream
+    double seek_time;
+
+    /// Number of buffers to stream into, or 0 to use the file's own BufferCount
+    uint32_t buffer_count;
+  };
+
+  /**
+   * @brief Streams every top-level object in a file and replays its chunks against their times
+   *
+   * Each stream is played on its own, starting with a seek. The drive reads one BufferSize at a
+   * time into the next free buffer, and a buffer is only freed once every chunk in it has been
+   * played.
+   */
+  LIBWEAVER_EXPORT static Interleaf::Error Simulate(const char *f, const Settings &settings, SimulationReport *report);
+
+#ifdef _WIN32
+  LIBWEAVER_EXPORT static Interleaf::Error Simulate(const wchar_t *f, const Settings &settings, SimulationReport *report);
+#endif
+
+  static Interleaf::Error Simulate(FileBase *f, const Settings &settings, SimulationReport *report);
+
+  /**
+   * @brief Streams a file from what Interleaf::PlanLayout() worked out, without it being written
+   *
+   * Gives the same results as writing the file and simulating that.
+   */
+  LIBWEAVER_EXPORT static Interleaf::Error Simulate(const LayoutReport &layout, const Settings &settings, SimulationReport *report);
+
+private:
+  typedef LayoutReport::ChunkPlacement Chunk;
+
+  static bool ReadStreamChunks(FileBase *f, uint32_t offset, uint32_t buffer_size, uint32_t *id, uint32_t *end, std::vector<Chunk> *chunks);
+
+  static void SimulateStream(const Settings &settings, uint32_t buffer_size, uint32_t buffer_count, uint32_t offset, uint32_t end, const std::vector<Chunk> &chunks, SimulationReport::StreamResult *result, std::map<uint32_t, SimulationReport::ObjectResult> *objects);
+
+};
+
+}
+
+#endif // SIMULATOR_H
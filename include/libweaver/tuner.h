@@ -0,0 +1,75 @@
+#ifndef TUNER_H
+#define TUNER_H
+
+#include "interleaf.h"
+#include "simulator.h"
+#include "types.h"
+
+namespace si {
+
+/**
+ * @brief How an Interleaf would turn out with different buffer sizes and counts
+ */
+struct BufferTuning
+{
+  struct Candidate
+  {
+    uint32_t buffer_size;
+    uint32_t buffer_count;
+
+    /// False if a stream's header doesn't fit in one buffer, nothing else is filled in then
+    bool valid;
+
+    uint64_t file_size;
+    uint64_t padding_bytes;
+    uint32_t split_chunks;
+
+    /// Results of streaming it with Simulator
+    uint32_t underruns;
+    double worst_lateness;
+
+    /// Most memory taken up by buffers holding data at once
+    uint64_t peak_memory;
+  };
+
+  std::vector<Candidate> candidates;
+
+  /// Index of the best candidate, or candidates.size() if none of them are valid
+  size_t recommended;
+};
+
+class BufferTuner
+{
+public:
+  struct Settings
+  {
+    LIBWEAVER_EXPORT Settings();
+
+    std::vector<uint32_t> buffer_sizes;
+    std::vector<uint32_t> buffer_counts;
+
+    /// Flags the file will be written with, see Interleaf::WriteFlags
+    int write_flags;
+
+    /// Drive to simulate, its buffer count is replaced with each candidate's
+    Simulator::Settings drive;
+  };
+
+  /**
+   * @brief Tries every combination of buffer size and count on an Interleaf
+   *
+   * Each buffer size is laid out once with Interleaf::PlanLayout() and then streamed with every
+   * buffer count, without writing anything. The recommendation is whichever streams with the
+   * fewest underruns, then has the smallest file, then uses the least memory. The Interleaf is
+   * left as it was, including its current buffer size, which may be 0 for a new file.
+   */
+  LIBWEAVER_EXPORT static Interleaf::Error Tune(Interleaf *interleaf, const Settings &settings, BufferTuning *tuning);
+
+private:
+  static bool IsBetter(const BufferTuning::Candidate &a, const BufferTuning::Candidate &b);
+
+};
+
+}
+
+#endif // TUNER_H
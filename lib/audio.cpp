@@ -0,0 +1,268 @@
+#include "audio.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace si {
+
+bool AudioConverter::IsSupported(const WAVFmt &fmt)
+{
+  return fmt.Format == 1
+      && (fmt.BitsPerSample == 8 || fmt.BitsPerSample == 16)
+      && fmt.Channels > 0
+      && fmt.SampleRate > 0;
+}
+
+bool AudioConverter::NeedsConversion(const WAVFmt &from, const WAVFmt &to)
+{
+  return from.SampleRate != to.SampleRate
+      || from.Channels != to.Channels
+      || from.BitsPerSample != to.BitsPerSample;
+}
+
+bool AudioConverter::Convert(const WAVFmt &from, const bytearray &in, const WAVFmt &to, bytearray *out, bool normalize)
+{
+  if (!IsSupported(from) || !IsSupported(to)) {
+    return false;
+  }
+
+  AudioConverter converter(from, to);
+  out->clear();
+
+  if (normalize) {
+    converter.Convert(in.data(), in.size(), NULL);
+    converter.Finish(NULL);
+    converter.SetGain(converter.NormalizeGain());
+  }
+
+  converter.Convert(in.data(), in.size(), out);
+  converter.Finish(out);
+
+  return true;
+}
+
+AudioConverter::AudioConverter(const WAVFmt &from, const WAVFmt &to) :
+  from_(from),
+  to_(to)
+{
+  filter_ = to.SampleRate < from.SampleRate;
+  width_ = filter_ ? (from.SampleRate + to.SampleRate - 1) / to.SampleRate : 1;
+  half_ = width_ / 2;
+  step_ = double(from.SampleRate) / to.SampleRate;
+
+  gain_ = 1.0f;
+  peak_ = 0;
+
+  Reset();
+}
+
+void AudioConverter::Reset()
+{
+  partial_.clear();
+  base_ = 0;
+  received_ = 0;
+  frames_.clear();
+  sums_.assign(filter_ ? to_.Channels : 0, 0.0);
+  emitted_ = 0;
+}
+
+float AudioConverter::NormalizeGain() const
+{
+  return (peak_ > 0) ? 0.98f / peak_ : 1.0f;
+}
+
+void AudioConverter::Convert(const char *data, size_t size, bytearray *out)
+{
+  size_t frame_size = from_.Channels * (from_.BitsPerSample/8);
+
+  // Finish the frame the last piece ended partway through first
+  if (!partial_.empty()) {
+    size_t n = std::min(frame_size - partial_.size(), size);
+    partial_.append(data, n);
+    data += n;
+    size -= n;
+
+    if (partial_.size() < frame_size) {
+      return;
+    }
+
+    Add(partial_.data(), 1);
+    partial_.clear();
+  }
+
+  size_t frames = size / frame_size;
+  Add(data, frames);
+  partial_.append(data + frames * frame_size, size - frames * frame_size);
+
+  Emit(false, out);
+}
+
+void AudioConverter::Finish(bytearray *out)
+{
+  // Like the end of the last frame, anything that isn't a whole frame is dropped
+  Emit(true, out);
+  Reset();
+}
+
+void AudioConverter::Add(const char *data, size_t frames)
+{
+  if (!frames) {
+    return;
+  }
+
+  // Everything in between is done on floats, the loops are kept simple so they vectorize
+  size_t in_channels = from_.Channels;
+  size_t out_channels = to_.Channels;
+  size_t count = frames * in_channels;
+
+  decoded_.resize(count);
+  float *in = &decoded_[0];
+
+  if (from_.BitsPerSample == 16) {
+    const int16_t *src = reinterpret_cast<const int16_t*>(data);
+    for (size_t i = 0; i < count; i++) {
+      in[i] = src[i] * (1.0f / 32768.0f);
+    }
+  } else {
+    // 8-bit WAV is unsigned
+    const uint8_t *src = reinterpret_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < count; i++) {
+      in[i] = (int(src[i]) - 128) * (1.0f / 128.0f);
+    }
+  }
+
+  size_t old_size = frames_.size();
+  frames_.resize(old_size + frames * out_channels);
+  float *mixed = &frames_[old_size];
+
+  if (in_channels == out_channels) {
+    std::copy(in, in + count, mixed);
+  } else if (out_channels == 1) {
+    // Average everything down to mono
+    float scale = 1.0f / in_channels;
+    for (size_t i = 0; i < frames; i++) {
+      float sum = 0;
+      for (size_t c = 0; c < in_channels; c++) {
+        sum += in[i * in_channels + c];
+      }
+      mixed[i] = sum * scale;
+    }
+  } else {
+    // Otherwise copy channels across, repeating them if there are more outputs than inputs
+    for (size_t i = 0; i < frames; i++) {
+      for (size_t c = 0; c < out_channels; c++) {
+        mixed[i * out_channels + c] = in[i * in_channels + c % in_channels];
+      }
+    }
+  }
+
+  if (filter_) {
+    // Averaging over any span is then just the difference of two sums
+    size_t last = sums_.size() - out_channels;
+    sums_.resize(sums_.size() + frames * out_channels);
+    for (size_t i = 0; i < frames * out_channels; i++) {
+      sums_[last + out_channels + i] = sums_[last + i] + mixed[i];
+    }
+  }
+
+  received_ += frames;
+}
+
+float AudioConverter::GetFiltered(size_t frame, size_t channel, size_t end) const
+{
+  size_t channels = to_.Channels;
+
+  if (!filter_) {
+    return frames_[(frame - base_) * channels + channel];
+  }
+
+  size_t start = FilterStart(frame);
+  end = std::min(start + width_, end);
+  return float((sums_[(end - base_) * channels + channel] - sums_[(start - base_) * channels + channel]) / (end - start));
+}
+
+void AudioConverter::Emit(bool finished, bytearray *out)
+{
+  size_t channels = to_.Channels;
+  block_.clear();
+
+  if (from_.SampleRate == to_.SampleRate) {
+    block_.assign(frames_.begin(), frames_.end());
+    emitted_ = received_;
+  } else {
+    // The clip might still go on, so only what's certain to be in it is made, and each output
+    // waits until the inputs on both sides of it are in
+    uint64_t total = uint64_t(received_) * to_.SampleRate / from_.SampleRate;
+    while (emitted_ < total) {
+      double pos = emitted_ * step_;
+      size_t p = size_t(pos);
+      size_t q;
+      if (finished) {
+        q = std::min(p + 1, received_ - 1);
+      } else {
+        q = p + 1;
+        if (q >= received_ || FilterStart(q) + width_ > received_) {
+          break;
+        }
+      }
+      float frac = float(pos - p);
+
+      // Then interpolate linearly between the two nearest inputs
+      for (size_t c = 0; c < channels; c++) {
+        float a = GetFiltered(p, c, received_);
+        float b = GetFiltered(q, c, received_);
+        block_.push_back(a + (b - a) * frac);
+      }
+
+      emitted_++;
+    }
+  }
+
+  for (size_t i = 0; i < block_.size(); i++) {
+    peak_ = std::max(peak_, float(std::fabs(block_[i])));
+  }
+
+  if (out) {
+    if (gain_ != 1.0f) {
+      for (size_t i = 0; i < block_.size(); i++) {
+        block_[i] *= gain_;
+      }
+    }
+    Encode(block_.empty() ? NULL : &block_[0], block_.size(), out);
+  }
+
+  // Let go of the inputs nothing left to make needs
+  size_t keep = std::min(FilterStart(size_t(emitted_ * step_)), received_);
+  if (keep > base_) {
+    frames_.erase(frames_.begin(), frames_.begin() + (keep - base_) * channels);
+    if (filter_) {
+      sums_.erase(sums_.begin(), sums_.begin() + (keep - base_) * channels);
+    }
+    base_ = keep;
+  }
+}
+
+void AudioConverter::Encode(const float *in, size_t count, bytearray *out)
+{
+  size_t old_size = out->size();
+  out->resize(old_size + count * (to_.BitsPerSample/8));
+  if (!count) {
+    return;
+  }
+
+  if (to_.BitsPerSample == 16) {
+    int16_t *dst = reinterpret_cast<int16_t*>(out->data() + old_size);
+    for (size_t i = 0; i < count; i++) {
+      float v = std::min(std::max(in[i] * 32767.0f, -32768.0f), 32767.0f);
+      dst[i] = int16_t(std::floor(v + 0.5f));
+    }
+  } else {
+    uint8_t *dst = reinterpret_cast<uint8_t*>(out->data() + old_size);
+    for (size_t i = 0; i < count; i++) {
+      float v = std::min(std::max(in[i] * 127.0f + 128.0f, 0.0f), 255.0f);
+      dst[i] = uint8_t(std::floor(v + 0.5f));
+    }
+  }
+}
+
+}
@@ -0,0 +1,123 @@
+#include "chunkeddata.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace si {
+
+// Copies may be made and dropped from different threads, so reference counts change atomically
+long AtomicIncrement(volatile long *v)
+{
+#ifdef _WIN32
+  return InterlockedIncrement(v);
+#else
+  return __sync_add_and_fetch(v, 1);
+#endif
+}
+
+long AtomicDecrement(volatile long *v)
+{
+#ifdef _WIN32
+  return InterlockedDecrement(v);
+#else
+  return __sync_sub_and_fetch(v, 1);
+#endif
+}
+
+ChunkedData::ChunkedData()
+{
+  m_Shared = NULL;
+}
+
+ChunkedData::ChunkedData(const ChunkedData &other)
+{
+  m_Shared = other.m_Shared;
+  if (m_Shared) {
+    AtomicIncrement(&m_Shared->refs);
+  }
+}
+
+ChunkedData::~ChunkedData()
+{
+  Release();
+}
+
+ChunkedData &ChunkedData::operator=(const ChunkedData &other)
+{
+  if (other.m_Shared != m_Shared) {
+    if (other.m_Shared) {
+      AtomicIncrement(&other.m_Shared->refs);
+    }
+    Release();
+    m_Shared = other.m_Shared;
+  }
+  return *this;
+}
+
+void ChunkedData::push_back(const bytearray &chunk)
+{
+  Detach();
+  m_Shared->chunks.push_back(chunk);
+}
+
+void ChunkedData::resize(size_t size)
+{
+  Detach();
+  m_Shared->chunks.resize(size);
+}
+
+void ChunkedData::reserve(size_t size)
+{
+  Detach();
+  m_Shared->chunks.reserve(size);
+}
+
+void ChunkedData::clear()
+{
+  // Nothing needs copying, so just let go of the chunks
+  Release();
+}
+
+bytearray &ChunkedData::Modify(size_t i)
+{
+  Detach();
+  return m_Shared->chunks.at(i);
+}
+
+void ChunkedData::Assign(std::vector<bytearray> *chunks)
+{
+  Release();
+  Detach();
+  m_Shared->chunks.swap(*chunks);
+}
+
+const std::vector<bytearray> &ChunkedData::Empty()
+{
+  static const std::vector<bytearray> empty;
+  return empty;
+}
+
+void ChunkedData::Detach()
+{
+  if (!m_Shared) {
+    m_Shared = new Shared();
+    m_Shared->refs = 1;
+  } else if (m_Shared->refs > 1) {
+    Shared *copy = new Shared();
+    copy->chunks = m_Shared->chunks;
+    copy->refs = 1;
+    Release();
+    m_Shared = copy;
+  }
+}
+
+void ChunkedData::Release()
+{
+  if (m_Shared && AtomicDecrement(&m_Shared->refs) == 0) {
+    delete m_Shared;
+  }
+  m_Shared = NULL;
+}
+
+}
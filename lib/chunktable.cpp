@@ -0,0 +1,98 @@
+#include "chunktable.h"
+
+#include "sitypes.h"
+
+namespace si {
+
+void ChunkTable::clear()
+{
+  chunks_.clear();
+  descriptions_.clear();
+}
+
+uint32_t ChunkTable::GetChild(uint32_t parent, uint32_t row) const
+{
+  uint32_t c = chunks_.at(parent).first_child;
+  for (uint32_t i = 0; i < row && c != NONE; i++) {
+    c = chunks_[c].next_sibling;
+  }
+  return c;
+}
+
+std::string ChunkTable::GetDescription(uint32_t i) const
+{
+  const Chunk &c = chunks_.at(i);
+  return descriptions_.substr(c.desc_offset, c.desc_size);
+}
+
+bool ChunkTable::HasData(uint32_t i) const
+{
+  const Chunk &c = chunks_.at(i);
+  return c.type == RIFF::MxCh && c.size > MxCh::HEADER_SIZE;
+}
+
+uint32_t ChunkTable::GetDataOffset(uint32_t i) const
+{
+  // Data follows the chunk header and the MxCh header
+  return chunks_.at(i).offset + sizeof(uint32_t)*2 + MxCh::HEADER_SIZE;
+}
+
+uint32_t ChunkTable::GetDataSize(uint32_t i) const
+{
+  return HasData(i) ? chunks_.at(i).size - MxCh::HEADER_SIZE : 0;
+}
+
+bool ChunkTable::ReadData(FileBase *f, uint32_t i, bytearray *data) const
+{
+  if (!HasData(i)) {
+    data->clear();
+    return true;
+  }
+
+  f->seek(GetDataOffset(i), FileBase::SeekStart);
+
+  data->resize(GetDataSize(i));
+  return f->ReadData(data->data(), data->size()) == FileBase::pos_t(data->size());
+}
+
+uint32_t ChunkTable::Append(uint32_t parent, uint32_t previous)
+{
+  uint32_t i = uint32_t(chunks_.size());
+
+  Chunk c;
+  c.type = 0;
+  c.offset = 0;
+  c.size = 0;
+  c.object_id = NONE;
+  c.parent = parent;
+  c.first_child = NONE;
+  c.next_sibling = NONE;
+  c.child_count = 0;
+  c.row = 0;
+  c.desc_offset = 0;
+  c.desc_size = 0;
+
+  if (parent != NONE) {
+    Chunk &p = chunks_[parent];
+    c.row = p.child_count;
+    p.child_count++;
+    if (previous == NONE) {
+      p.first_child = i;
+    } else {
+      chunks_[previous].next_sibling = i;
+    }
+  }
+
+  chunks_.push_back(c);
+  return i;
+}
+
+void ChunkTable::SetDescription(uint32_t i, const std::string &d)
+{
+  Chunk &c = chunks_[i];
+  c.desc_offset = uint32_t(descriptions_.size());
+  c.desc_size = uint32_t(d.size());
+  descriptions_.append(d);
+}
+
+}
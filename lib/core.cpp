@@ -7,6 +7,7 @@ namespace si {
 Core::Core()
 {
   parent_ = NULL;
+  index_ = 0;
 }
 
 Core::~Core()
@@ -33,6 +34,15 @@ bool Core::FindParent(Core *p) const
   return false;
 }
 
+Core *Core::GetRoot()
+{
+  Core *root = this;
+  while (root->parent_) {
+    root = root->parent_;
+  }
+  return root;
+}
+
 void Core::AppendChild(Core *chunk)
 {
   InsertChild(children_.size(), chunk);
@@ -45,37 +55,51 @@ bool Core::RemoveChild(Core *chunk)
     return false;
   }
 
-  // Find chunk in children, if doesn't exist, return false
-  Children::iterator it = std::find(children_.begin(), children_.end(), chunk);
-  if (it == children_.end()) {
-    return false;
-  }
+  GetRoot()->OnDescendantRemoved(chunk);
 
+  size_t index = chunk->index_;
   chunk->parent_ = NULL;
-  children_.erase(it);
+  chunk->index_ = 0;
+  children_.erase(children_.begin() + index);
+  UpdateChildIndexes(index);
   return true;
 }
 
 void Core::DeleteChildren()
 {
-  // Delete children
-  Children copy = children_;
-  for (Children::iterator it = copy.begin(); it != copy.end(); it++) {
+  // Detach the children first, so they don't each erase themselves from the vector on the way out
+  Children children;
+  children.swap(children_);
+  Core *root = GetRoot();
+  for (Children::iterator it = children.begin(); it != children.end(); it++) {
+    root->OnDescendantRemoved(*it);
+    (*it)->parent_ = NULL;
     delete (*it);
   }
 }
 
 size_t Core::IndexOfChild(Core *chunk) const
 {
-  return std::find(children_.begin(), children_.end(), chunk) - children_.begin();
+  // Like searching, anything that isn't a child is past the end
+  return (chunk->parent_ == this) ? chunk->index_ : children_.size();
 }
 
 void Core::InsertChild(size_t index, Core *chunk)
 {
-  if (chunk == this || FindParent(chunk)) {
+  if (chunk == this) {
     return;
   }
 
+  // Inserting an ancestor would make a cycle. The same walk finds the root to notify afterwards,
+  // which taking the chunk away from its current parent can't change.
+  Core *root = this;
+  while (root->parent_) {
+    if (root->parent_ == chunk) {
+      return;
+    }
+    root = root->parent_;
+  }
+
   // If this chunk has another parent, remove it from that parent
   if (chunk->parent_) {
     chunk->parent_->RemoveChild(chunk);
@@ -84,6 +108,17 @@ void Core::InsertChild(size_t index, Core *chunk)
   // Insert at position
   chunk->parent_ = this;
   children_.insert(children_.begin() + index, chunk);
+  UpdateChildIndexes(index);
+
+  root->OnDescendantAdded(chunk);
+}
+
+void Core::UpdateChildIndexes(size_t from)
+{
+  // Appending, by far the most common, only touches the new child
+  for (size_t i = from; i < children_.size(); i++) {
+    children_[i]->index_ = i;
+  }
 }
 
 }
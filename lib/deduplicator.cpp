@@ -0,0 +1,272 @@
+#include "deduplicator.h"
+
+#include <algorithm>
+#include <map>
+
+#include "parallel.h"
+
+namespace si {
+
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t RotateLeft(uint64_t v, int bits)
+{
+  return (v << bits) | (v >> (64 - bits));
+}
+
+inline uint64_t Read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t Read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t HashRound(uint64_t acc, uint64_t input)
+{
+  acc += input * kPrime2;
+  acc = RotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t acc, uint64_t v)
+{
+  acc ^= HashRound(0, v);
+  return acc * kPrime1 + kPrime4;
+}
+
+class HashJob : public ParallelJob
+{
+public:
+  HashJob(const std::vector<DuplicateReport::Asset> &assets, std::vector<uint64_t> *hashes) :
+    assets_(assets),
+    hashes_(hashes)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    (*hashes_)[index] = Deduplicator::Hash(assets_[index].object->data());
+  }
+
+private:
+  const std::vector<DuplicateReport::Asset> &assets_;
+  std::vector<uint64_t> *hashes_;
+
+};
+
+class MoreWasteful
+{
+public:
+  bool operator()(const DuplicateReport::Group &a, const DuplicateReport::Group &b) const
+  {
+    return a.size * (a.assets.size() - 1) > b.size * (b.assets.size() - 1);
+  }
+};
+
+uint64_t Deduplicator::Hash(const void *data, size_t size, uint64_t seed)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const uint8_t *end = p + size;
+  uint64_t h;
+
+  if (size >= 32) {
+    // Four independent lanes keep the multipliers busy
+    uint64_t v1 = seed + kPrime1 + kPrime2;
+    uint64_t v2 = seed + kPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime1;
+
+    const uint8_t *limit = end - 32;
+    do {
+      v1 = HashRound(v1, Read64(p));
+      v2 = HashRound(v2, Read64(p + 8));
+      v3 = HashRound(v3, Read64(p + 16));
+      v4 = HashRound(v4, Read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+    h = MergeRound(h, v1);
+    h = MergeRound(h, v2);
+    h = MergeRound(h, v3);
+    h = MergeRound(h, v4);
+  } else {
+    h = seed + kPrime5;
+  }
+
+  h += size;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= HashRound(0, Read64(p));
+    h = RotateLeft(h, 27) * kPrime1 + kPrime4;
+  }
+
+  if (p + 4 <= end) {
+    h ^= uint64_t(Read32(p)) * kPrime1;
+    h = RotateLeft(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    h ^= (*p) * kPrime5;
+    h = RotateLeft(h, 11) * kPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+uint64_t Deduplicator::Hash(const ChunkedData &data)
+{
+  // Seeding each chunk with the size makes the boundaries part of the hash
+  uint64_t h = 0;
+  for (size_t i = 0; i < data.size(); i++) {
+    const bytearray &chunk = data.at(i);
+    h = Hash(chunk.data(), chunk.size(), h + chunk.size());
+  }
+  return h;
+}
+
+void Deduplicator::FindDuplicates(const std::vector<Interleaf*> &files, DuplicateReport *report, size_t threads)
+{
+  report->groups.clear();
+  report->duplicate_bytes = 0;
+
+  std::vector<DuplicateReport::Asset> assets;
+  for (size_t i = 0; i < files.size(); i++) {
+    CollectObjects(files[i], i, &assets);
+  }
+
+  std::vector<uint64_t> hashes(assets.size());
+  HashJob job(assets, &hashes);
+  Parallel::Run(&job, assets.size(), threads);
+
+  std::map<uint64_t, std::vector<size_t> > by_hash;
+  for (size_t i = 0; i < assets.size(); i++) {
+    by_hash[hashes[i]].push_back(i);
+  }
+
+  for (std::map<uint64_t, std::vector<size_t> >::const_iterator it = by_hash.begin(); it != by_hash.end(); it++) {
+    const std::vector<size_t> &matches = it->second;
+    if (matches.size() < 2) {
+      continue;
+    }
+
+    // Split the matches into groups that really are equal
+    size_t first_group = report->groups.size();
+    for (size_t i = 0; i < matches.size(); i++) {
+      const DuplicateReport::Asset &asset = assets[matches[i]];
+
+      size_t g = first_group;
+      for (; g < report->groups.size(); g++) {
+        if (IsEqual(report->groups[g].assets.front().object->data(), asset.object->data())) {
+          break;
+        }
+      }
+
+      if (g == report->groups.size()) {
+        DuplicateReport::Group group;
+        group.hash = it->first;
+        group.size = GetSize(asset.object->data());
+        report->groups.push_back(group);
+      }
+      report->groups[g].assets.push_back(asset);
+    }
+
+    // Anything left on its own was a collision
+    for (size_t g = first_group; g < report->groups.size(); ) {
+      if (report->groups[g].assets.size() < 2) {
+        report->groups.erase(report->groups.begin() + g);
+      } else {
+        g++;
+      }
+    }
+  }
+
+  std::sort(report->groups.begin(), report->groups.end(), MoreWasteful());
+
+  for (size_t i = 0; i < report->groups.size(); i++) {
+    const DuplicateReport::Group &g = report->groups[i];
+    report->duplicate_bytes += g.size * (g.assets.size() - 1);
+  }
+}
+
+uint64_t Deduplicator::Share(const DuplicateReport &report)
+{
+  uint64_t freed = 0;
+
+  for (size_t i = 0; i < report.groups.size(); i++) {
+    const DuplicateReport::Group &g = report.groups[i];
+    const ChunkedData &original = g.assets.front().object->data();
+
+    for (size_t j = 1; j < g.assets.size(); j++) {
+      Object *o = g.assets[j].object;
+      if (!o->data_.IsSharedWith(original)) {
+        o->data_ = original;
+        freed += g.size;
+      }
+    }
+  }
+
+  return freed;
+}
+
+void Deduplicator::CollectObjects(Core *parent, size_t file, std::vector<DuplicateReport::Asset> *assets)
+{
+  for (size_t i = 0; i < parent->GetChildCount(); i++) {
+    Object *o = static_cast<Object*>(parent->GetChildAt(i));
+    if (!o->data().empty()) {
+      DuplicateReport::Asset a;
+      a.file = file;
+      a.object = o;
+      assets->push_back(a);
+    }
+    CollectObjects(o, file, assets);
+  }
+}
+
+bool Deduplicator::IsEqual(const ChunkedData &a, const ChunkedData &b)
+{
+  if (a.IsSharedWith(b)) {
+    return true;
+  }
+
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a.at(i) != b.at(i)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+uint64_t Deduplicator::GetSize(const ChunkedData &data)
+{
+  uint64_t size = 0;
+  for (size_t i = 0; i < data.size(); i++) {
+    size += data.at(i).size();
+  }
+  return size;
+}
+
+}
@@ -0,0 +1,246 @@
+#include "extractor.h"
+
+#include <algorithm>
+#include <map>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+#include "objectstream.h"
+#include "parallel.h"
+
+namespace si {
+
+static const size_t kWriteBufferSize = 1024 * 1024;
+
+class LargerItem
+{
+public:
+  template <typename T>
+  bool operator()(const T &a, const T &b) const
+  {
+    return a.size > b.size;
+  }
+};
+
+class ExtractJob : public ParallelJob
+{
+public:
+  ExtractJob(const std::vector<Extractor::Item> &items, const std::vector<Extractor::Group> &groups, size_t tasks) :
+    items_(items),
+    groups_(groups),
+    failed_(tasks)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    // Each task takes every nth group so it can keep one buffer for all of them. Groups are
+    // sorted largest first, which keeps the tasks roughly even.
+    bytearray buffer(kWriteBufferSize);
+    for (size_t i = index; i < groups_.size(); i += failed_.size()) {
+      const std::vector<size_t> &group = groups_[i].items;
+      for (size_t j = 0; j < group.size(); j++) {
+        if (!Extractor::WriteItem(items_[group[j]], &buffer)) {
+          failed_[index].push_back(group[j]);
+        }
+      }
+    }
+  }
+
+  const std::vector< std::vector<size_t> > &failed() const { return failed_; }
+
+private:
+  const std::vector<Extractor::Item> &items_;
+  const std::vector<Extractor::Group> &groups_;
+  std::vector< std::vector<size_t> > failed_;
+
+};
+
+#ifdef _WIN32
+std::wstring WidenPath(const std::string &path)
+{
+  int n = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), int(path.size()), NULL, 0);
+  std::wstring w(n, L'\0');
+  if (n > 0) {
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), int(path.size()), &w[0], n);
+  }
+  return w;
+}
+#endif
+
+bool CreateDirectories(const std::string &path)
+{
+  for (size_t i = 1; i <= path.size(); i++) {
+    if (i < path.size() && path[i] != '/' && path[i] != '\\') {
+      continue;
+    }
+
+    std::string part = path.substr(0, i);
+#ifdef _WIN32
+    if (part[part.size() - 1] == ':') {
+      // Drive letters can't be created
+      continue;
+    }
+    if (!CreateDirectoryW(WidenPath(part).c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+      return false;
+    }
+#else
+    if (mkdir(part.c_str(), 0777) != 0 && errno != EEXIST) {
+      return false;
+    }
+#endif
+  }
+
+  return true;
+}
+
+std::string FoldCase(const std::string &path)
+{
+  // Only ASCII letters are folded, which leaves the rest of UTF-8 alone
+  std::string s = path;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] >= 'A' && s[i] <= 'Z') {
+      s[i] = s[i] - 'A' + 'a';
+    }
+  }
+  return s;
+}
+
+void Extractor::ExtractAll(const std::vector<Target> &targets, ExtractReport *report, size_t threads)
+{
+  report->errors.clear();
+  report->files = 0;
+  report->bytes = 0;
+
+  // Directories are made up front, so the pool only has files to write
+  std::vector<Item> items;
+  for (size_t i = 0; i < targets.size(); i++) {
+    CollectItems(targets[i].root, targets[i].directory, &items, report);
+  }
+
+  // Objects can share a filename, and writing them at the same time would mix their contents.
+  // They're written one after another in tree order instead, so the last one ends up in the file
+  // like it always has. Case is ignored since it is on Windows.
+  std::vector<Group> groups;
+  std::map<std::string, size_t> group_of_path;
+  for (size_t i = 0; i < items.size(); i++) {
+    std::pair<std::map<std::string, size_t>::iterator, bool> it = group_of_path.insert(std::make_pair(FoldCase(items[i].path), groups.size()));
+    if (it.second) {
+      groups.push_back(Group());
+      groups.back().size = 0;
+    }
+
+    Group &g = groups[it.first->second];
+    g.items.push_back(i);
+    g.size += items[i].size;
+  }
+
+  std::stable_sort(groups.begin(), groups.end(), LargerItem());
+
+  if (!threads) {
+    threads = Parallel::GetDefaultThreadCount();
+  }
+  size_t tasks = std::max(size_t(1), std::min(threads, groups.size()));
+
+  ExtractJob job(items, groups, tasks);
+  Parallel::Run(&job, tasks, threads);
+
+  std::vector<bool> ok(items.size(), true);
+  for (size_t i = 0; i < job.failed().size(); i++) {
+    for (size_t j = 0; j < job.failed()[i].size(); j++) {
+      ok[job.failed()[i][j]] = false;
+    }
+  }
+
+  for (size_t i = 0; i < items.size(); i++) {
+    if (ok[i]) {
+      report->files++;
+      report->bytes += items[i].size;
+    } else {
+      ExtractReport::Error e;
+      e.reason = ExtractReport::FileFailed;
+      e.path = items[i].path;
+      e.object = items[i].object;
+      report->errors.push_back(e);
+    }
+  }
+}
+
+void Extractor::ExtractAll(const Core *root, const std::string &directory, ExtractReport *report, size_t threads)
+{
+  std::vector<Target> targets(1);
+  targets[0].root = root;
+  targets[0].directory = directory;
+  ExtractAll(targets, report, threads);
+}
+
+std::string Extractor::GetFilename(const Object *object)
+{
+  const std::string &filename = object->filename();
+  if (filename.empty()) {
+    return object->name() + ".bin";
+  }
+
+  // Filenames are the paths they were built from on Windows, only the last part is kept
+  size_t slash = filename.find_last_of('\\');
+  return (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+}
+
+void Extractor::CollectItems(const Core *parent, const std::string &directory, std::vector<Item> *items, ExtractReport *report)
+{
+  if (!CreateDirectories(directory)) {
+    ExtractReport::Error e;
+    e.reason = ExtractReport::DirectoryFailed;
+    e.path = directory;
+    e.object = NULL;
+    report->errors.push_back(e);
+    return;
+  }
+
+  for (size_t i = 0; i < parent->GetChildCount(); i++) {
+    const Object *o = dynamic_cast<const Object*>(parent->GetChildAt(i));
+    if (!o) {
+      continue;
+    }
+
+    if (!o->data().empty()) {
+      Item item;
+      item.object = o;
+      item.path = directory + "/" + GetFilename(o);
+      item.size = ObjectStream(o).size();
+      items->push_back(item);
+    }
+
+    if (o->HasChildren()) {
+      CollectItems(o, directory + "/" + o->name(), items, report);
+    }
+  }
+}
+
+bool Extractor::WriteItem(const Item &item, bytearray *buffer)
+{
+  File f;
+#ifdef _WIN32
+  if (!f.Open(WidenPath(item.path).c_str(), File::Write)) {
+#else
+  if (!f.Open(item.path.c_str(), File::Write)) {
+#endif
+    return false;
+  }
+
+  ObjectStream stream(item.object);
+  bool ok = true;
+  while (ok && !stream.atEnd()) {
+    FileBase::pos_t n = stream.ReadData(buffer->data(), buffer->size());
+    ok = f.WriteData(buffer->data(), n) == n;
+  }
+
+  return ok;
+}
+
+}
@@ -4,8 +4,16 @@
 #include <windows.h>
 #else
 #include <fstream>
+#include <sys/stat.h>
 #define FSTR(x) static_cast<std::fstream*>(x)
 #endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include <algorithm>
 
 namespace si {
@@ -19,10 +27,10 @@ bool File::Open(const char *c, Mode mode)
 {
 #ifdef _WIN32
   m_Handle = CreateFileA(c,
-                         mode == Read ? GENERIC_READ : GENERIC_WRITE,
+                         mode == Read ? GENERIC_READ : (mode == Write ? GENERIC_WRITE : GENERIC_READ | GENERIC_WRITE),
                          FILE_SHARE_READ,
                          NULL,
-                         mode == Read ? OPEN_EXISTING : CREATE_NEW,
+                         mode == Write ? CREATE_NEW : OPEN_EXISTING,
                          FILE_ATTRIBUTE_NORMAL,
                          NULL);
   m_Mode = mode;
@@ -32,8 +40,10 @@ bool File::Open(const char *c, Mode mode)
 
   if (mode == Read) {
     m |= std::ios::in;
-  } else {
+  } else if (mode == Write) {
     m |= std::ios::out;
+  } else {
+    m |= std::ios::in | std::ios::out;
   }
 
   m_Handle = new std::fstream();
@@ -51,10 +61,10 @@ bool File::Open(const char *c, Mode mode)
 bool File::Open(const wchar_t *c, Mode mode)
 {
   m_Handle = CreateFileW(c,
-                         mode == Read ? GENERIC_READ : GENERIC_WRITE,
+                         mode == Read ? GENERIC_READ : (mode == Write ? GENERIC_WRITE : GENERIC_READ | GENERIC_WRITE),
                          FILE_SHARE_READ,
                          NULL,
-                         mode == Read ? OPEN_EXISTING : CREATE_NEW,
+                         mode == Write ? CREATE_NEW : OPEN_EXISTING,
                          FILE_ATTRIBUTE_NORMAL,
                          NULL);
   return m_Handle != INVALID_HANDLE_VALUE;
@@ -171,6 +181,147 @@ File::pos_t File::WriteData(const void *data, File::pos_t size)
 #endif
 }
 
+#ifdef __linux__
+bool CopyRangeInKernel(int source, int destination, const File::Range &r)
+{
+#ifdef FICLONERANGE
+  // Shares the extents outright, but only works when the range lines up with filesystem blocks
+  file_clone_range clone;
+  clone.src_fd = source;
+  clone.src_offset = r.source;
+  clone.src_length = r.size;
+  clone.dest_offset = r.destination;
+  if (ioctl(destination, FICLONERANGE, &clone) == 0) {
+    return true;
+  }
+#endif
+
+#ifdef SYS_copy_file_range
+  // Still shares whatever whole blocks it can on filesystems that support it
+  loff_t in = r.source;
+  loff_t out = r.destination;
+  File::pos_t remaining = r.size;
+  while (remaining > 0) {
+    long copied = syscall(SYS_copy_file_range, source, &in, destination, &out, size_t(remaining), 0u);
+    if (copied <= 0) {
+      return false;
+    }
+    remaining -= copied;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+#endif
+
+bool File::CopyRanges(const char *source, const char *destination, const std::vector<Range> &ranges)
+{
+  size_t i = 0;
+
+#ifdef __linux__
+  int in = open(source, O_RDONLY);
+  int out = open(destination, O_WRONLY);
+  if (in != -1 && out != -1) {
+    while (i < ranges.size() && CopyRangeInKernel(in, out, ranges[i])) {
+      i++;
+    }
+  }
+  if (in != -1) {
+    close(in);
+  }
+  if (out != -1) {
+    close(out);
+  }
+#endif
+
+  if (i == ranges.size()) {
+    return true;
+  }
+
+  File in_file, out_file;
+  if (!in_file.Open(source, Read) || !out_file.Open(destination, ReadWrite)) {
+    return false;
+  }
+  return CopyRangesWithFiles(&in_file, &out_file, ranges, i);
+}
+
+#ifdef _WIN32
+bool File::CopyRanges(const wchar_t *source, const wchar_t *destination, const std::vector<Range> &ranges)
+{
+  File in_file, out_file;
+  if (!in_file.Open(source, Read) || !out_file.Open(destination, ReadWrite)) {
+    return false;
+  }
+  return CopyRangesWithFiles(&in_file, &out_file, ranges, 0);
+}
+#endif
+
+#ifdef _WIN32
+static bool GetFileID(HANDLE h, BY_HANDLE_FILE_INFORMATION *info)
+{
+  if (h == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  bool ok = GetFileInformationByHandle(h, info);
+  CloseHandle(h);
+  return ok;
+}
+
+static bool IsSameFileID(const BY_HANDLE_FILE_INFORMATION &a, const BY_HANDLE_FILE_INFORMATION &b)
+{
+  return a.dwVolumeSerialNumber == b.dwVolumeSerialNumber
+      && a.nFileIndexHigh == b.nFileIndexHigh
+      && a.nFileIndexLow == b.nFileIndexLow;
+}
+
+bool File::IsSameFile(const char *a, const char *b)
+{
+  BY_HANDLE_FILE_INFORMATION ia, ib;
+  return GetFileID(CreateFileA(a, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL), &ia)
+      && GetFileID(CreateFileA(b, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL), &ib)
+      && IsSameFileID(ia, ib);
+}
+
+bool File::IsSameFile(const wchar_t *a, const wchar_t *b)
+{
+  BY_HANDLE_FILE_INFORMATION ia, ib;
+  return GetFileID(CreateFileW(a, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL), &ia)
+      && GetFileID(CreateFileW(b, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL), &ib)
+      && IsSameFileID(ia, ib);
+}
+#else
+bool File::IsSameFile(const char *a, const char *b)
+{
+  struct stat sa, sb;
+  return stat(a, &sa) == 0 && stat(b, &sb) == 0
+      && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+#endif
+
+bool File::CopyRangesWithFiles(File *source, File *destination, const std::vector<Range> &ranges, size_t start)
+{
+  bytearray buf(0x10000);
+
+  for (size_t i = start; i < ranges.size(); i++) {
+    const Range &r = ranges[i];
+
+    source->seek(r.source);
+    destination->seek(r.destination);
+
+    pos_t remaining = r.size;
+    while (remaining > 0) {
+      pos_t piece = std::min(remaining, pos_t(buf.size()));
+      if (source->ReadData(buf.data(), piece) != piece || destination->WriteData(buf.data(), piece) != piece) {
+        return false;
+      }
+      remaining -= piece;
+    }
+  }
+
+  return true;
+}
+
 uint8_t FileBase::ReadU8()
 {
   uint8_t u;
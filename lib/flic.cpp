@@ -0,0 +1,631 @@
+#include "flic.h"
+
+#include "parallel.h"
+
+namespace si {
+
+static const size_t kFlicHeaderSize = 128;
+static const size_t kFrameHeaderSize = 16;
+static const uint16_t kFLIType = 0xAF11;
+static const uint16_t kFLCType = 0xAF12;
+
+class FlicEncodeJob : public ParallelJob
+{
+public:
+  FlicEncodeJob(const FlicCodec::Animation &animation, std::vector<bytearray> *chunks) :
+    animation_(animation),
+    chunks_(chunks)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    (*chunks_)[index + 1] = FlicCodec::EncodeFrame(animation_, index);
+  }
+
+private:
+  const FlicCodec::Animation &animation_;
+  std::vector<bytearray> *chunks_;
+
+};
+
+void WriteFlicChunk(MemoryBuffer *out, uint16_t type, const bytearray &body)
+{
+  // Chunks are kept to an even size
+  uint32_t padding = body.size() % 2;
+  out->WriteU32(uint32_t(6 + body.size() + padding));
+  out->WriteU16(type);
+  out->WriteBytes(body);
+  if (padding) {
+    out->WriteU8(0);
+  }
+}
+
+void PadPalette(const PaletteQuantizer::Palette &palette, PaletteQuantizer::Color *padded)
+{
+  memset(padded, 0, 256 * sizeof(PaletteQuantizer::Color));
+  for (size_t i = 0; i < palette.size() && i < 256; i++) {
+    padded[i] = palette[i];
+  }
+}
+
+bool SameColor(const PaletteQuantizer::Color &a, const PaletteQuantizer::Color &b)
+{
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+bool FlicCodec::Decode(FileBase *f, Animation *animation)
+{
+  FileBase::pos_t start = f->pos();
+  if (f->size() - start < kFlicHeaderSize) {
+    return false;
+  }
+
+  f->ReadU32(); // size, often wrong so the real file size is used instead
+  uint16_t type = f->ReadU16();
+  uint16_t frame_count = f->ReadU16();
+  animation->width = f->ReadU16();
+  animation->height = f->ReadU16();
+  uint16_t depth = f->ReadU16();
+  f->ReadU16(); // flags
+  uint32_t speed = f->ReadU32();
+
+  if ((type != kFLIType && type != kFLCType) || (depth != 8 && depth != 0)
+      || !animation->width || !animation->height) {
+    return false;
+  }
+
+  // FLI counts in 1/70ths of a second, FLC in milliseconds
+  animation->speed = (type == kFLIType) ? speed * 1000 / 70 : speed;
+
+  FileBase::pos_t first_frame = kFlicHeaderSize;
+  if (type == kFLCType) {
+    f->seek(start + 80);
+    uint32_t oframe1 = f->ReadU32();
+    if (oframe1) {
+      first_frame = oframe1;
+    }
+  }
+  f->seek(start + first_frame);
+
+  Frame current;
+  current.pixels.resize(size_t(animation->width) * animation->height);
+  memset(current.pixels.data(), 0, current.pixels.size());
+  current.palette.resize(256);
+  memset(&current.palette[0], 0, 256 * sizeof(PaletteQuantizer::Color));
+
+  animation->frames.clear();
+  while (animation->frames.size() < frame_count && f->size() - f->pos() >= 6) {
+    FileBase::pos_t chunk_start = f->pos();
+    uint32_t size = f->ReadU32();
+    uint16_t chunk_type = f->ReadU16();
+    if (size < 6) {
+      return false;
+    }
+
+    // Prefix chunks and anything else that isn't a frame is skipped
+    if (chunk_type == FRAME_TYPE) {
+      if (!DecodeFrame(f->ReadBytes(size - 6), animation->width, animation->height, &current)) {
+        return false;
+      }
+      animation->frames.push_back(current);
+    }
+
+    f->seek(chunk_start + size);
+  }
+
+  return !animation->frames.empty();
+}
+
+bool FlicCodec::DecodeFrame(const bytearray &data, uint16_t width, uint16_t height, Frame *frame)
+{
+  MemoryBuffer m(data);
+  if (m.size() < kFrameHeaderSize - 6) {
+    return false;
+  }
+
+  uint16_t chunks = m.ReadU16();
+  m.seek(kFrameHeaderSize - 6);
+
+  uint8_t *pixels = reinterpret_cast<uint8_t*>(frame->pixels.data());
+
+  for (uint16_t i = 0; i < chunks && m.size() - m.pos() >= 6; i++) {
+    FileBase::pos_t chunk_start = m.pos();
+    uint32_t size = m.ReadU32();
+    uint16_t type = m.ReadU16();
+    if (size < 6) {
+      return false;
+    }
+
+    switch (type) {
+    case COLOR_256:
+    case COLOR_64:
+    {
+      uint16_t packets = m.ReadU16();
+      size_t index = 0;
+      for (uint16_t p = 0; p < packets && !m.atEnd(); p++) {
+        index += m.ReadU8();
+        size_t count = m.ReadU8();
+        if (count == 0) {
+          count = 256;
+        }
+
+        for (size_t j = 0; j < count && index < 256 && !m.atEnd(); j++, index++) {
+          uint8_t rgb[3];
+          m.ReadData(rgb, 3);
+          if (type == COLOR_64) {
+            // Scale 6-bit values to the full 8 bits
+            for (int c = 0; c < 3; c++) {
+              rgb[c] = uint8_t((rgb[c] << 2) | (rgb[c] >> 4));
+            }
+          }
+          frame->palette[index].r = rgb[0];
+          frame->palette[index].g = rgb[1];
+          frame->palette[index].b = rgb[2];
+        }
+      }
+      break;
+    }
+    case BYTE_RUN:
+      for (uint16_t y = 0; y < height && !m.atEnd(); y++) {
+        m.ReadU8(); // packet count, unreliable for wide frames
+        uint8_t *row = pixels + size_t(y) * width;
+        uint16_t x = 0;
+        while (x < width && !m.atEnd()) {
+          int8_t count = int8_t(m.ReadU8());
+          if (count > 0) {
+            uint8_t value = m.ReadU8();
+            size_t n = std::min(size_t(count), size_t(width - x));
+            memset(row + x, value, n);
+            x += n;
+          } else if (count < 0) {
+            size_t n = std::min(size_t(-count), size_t(width - x));
+            m.ReadData(row + x, n);
+            x += n;
+          } else {
+            break;
+          }
+        }
+      }
+      break;
+    case DELTA_FLC:
+    {
+      uint16_t lines = m.ReadU16();
+      uint32_t y = 0;
+      for (uint16_t l = 0; l < lines && y < height && !m.atEnd(); l++) {
+        uint8_t *row = pixels + size_t(y) * width;
+        uint16_t packets = 0;
+
+        // Optional skip and last byte words come before the packet count
+        while (!m.atEnd()) {
+          uint16_t word = m.ReadU16();
+          if ((word & 0xC000) == 0xC000) {
+            y += 0x10000 - word;
+            if (y >= height) {
+              break;
+            }
+            row = pixels + size_t(y) * width;
+          } else if ((word & 0xC000) == 0x8000) {
+            row[width - 1] = uint8_t(word);
+          } else if ((word & 0xC000) == 0) {
+            packets = word;
+            break;
+          } else {
+            return false;
+          }
+        }
+        if (y >= height) {
+          break;
+        }
+
+        size_t x = 0;
+        for (uint16_t p = 0; p < packets && !m.atEnd(); p++) {
+          x += m.ReadU8();
+          int8_t count = int8_t(m.ReadU8());
+          if (count > 0) {
+            size_t n = std::min(size_t(count) * 2, width > x ? width - x : 0);
+            m.ReadData(row + x, n);
+            m.seek(size_t(count) * 2 - n, FileBase::SeekCurrent);
+            x += size_t(count) * 2;
+          } else if (count < 0) {
+            uint8_t word[2];
+            m.ReadData(word, 2);
+            for (int j = 0; j < -count; j++, x += 2) {
+              if (x < width) {
+                row[x] = word[0];
+              }
+              if (x + 1 < width) {
+                row[x + 1] = word[1];
+              }
+            }
+          }
+        }
+
+        y++;
+      }
+      break;
+    }
+    case DELTA_FLI:
+    {
+      uint32_t y = m.ReadU16();
+      uint16_t lines = m.ReadU16();
+      for (uint16_t l = 0; l < lines && y < height && !m.atEnd(); l++, y++) {
+        uint8_t *row = pixels + size_t(y) * width;
+        uint8_t packets = m.ReadU8();
+        size_t x = 0;
+        for (uint8_t p = 0; p < packets && !m.atEnd(); p++) {
+          x += m.ReadU8();
+          int8_t count = int8_t(m.ReadU8());
+          if (count > 0) {
+            size_t n = std::min(size_t(count), width > x ? width - x : 0);
+            m.ReadData(row + x, n);
+            m.seek(size_t(count) - n, FileBase::SeekCurrent);
+            x += count;
+          } else if (count < 0) {
+            uint8_t value = m.ReadU8();
+            size_t n = std::min(size_t(-count), width > x ? width - x : 0);
+            memset(row + x, value, n);
+            x += -count;
+          }
+        }
+      }
+      break;
+    }
+    case BLACK:
+      memset(pixels, 0, frame->pixels.size());
+      break;
+    case FLI_COPY:
+      m.ReadData(pixels, frame->pixels.size());
+      break;
+    default:
+      // Postage stamps and the like don't affect the image
+      break;
+    }
+
+    m.seek(chunk_start + size);
+  }
+
+  return true;
+}
+
+bool FlicCodec::Encode(const Animation &animation, std::vector<bytearray> *chunks, size_t threads)
+{
+  size_t pixel_count = size_t(animation.width) * animation.height;
+  if (!pixel_count || animation.frames.empty() || animation.frames.size() > 0xFFFF) {
+    return false;
+  }
+
+  for (size_t i = 0; i < animation.frames.size(); i++) {
+    if (animation.frames[i].pixels.size() != pixel_count) {
+      return false;
+    }
+  }
+
+  chunks->clear();
+  chunks->resize(animation.frames.size() + 1);
+
+  FlicEncodeJob job(animation, chunks);
+  Parallel::Run(&job, animation.frames.size(), threads);
+
+  // Sizes in the header are those of the file Object::ExtractToFile() rebuilds, which has the
+  // custom headers stripped and empty frames written out in full
+  uint32_t frame_sizes[2] = {0, 0};
+  uint32_t file_size = kFlicHeaderSize;
+  for (size_t i = 1; i < chunks->size(); i++) {
+    const bytearray &c = chunks->at(i);
+    uint32_t sz = (c.size() == kCustomHeaderSize) ? kFrameHeaderSize : c.size() - kCustomHeaderSize;
+    if (i <= 2) {
+      frame_sizes[i - 1] = sz;
+    }
+    file_size += sz;
+  }
+
+  MemoryBuffer header;
+  header.WriteU32(file_size);
+  header.WriteU16(kFLCType);
+  header.WriteU16(uint16_t(animation.frames.size()));
+  header.WriteU16(animation.width);
+  header.WriteU16(animation.height);
+  header.WriteU16(8); // depth
+  header.WriteU16(3); // flags
+  header.WriteU32(animation.speed);
+  header.WriteU16(0); // reserved1
+  header.WriteU32(0); // created
+  header.WriteU32(0); // creator
+  header.WriteU32(0); // updated
+  header.WriteU32(0); // updater
+  header.WriteU16(1); // aspect_dx
+  header.WriteU16(1); // aspect_dy
+  header.WriteBytes(bytearray(80 - header.pos()));
+  header.WriteU32(kFlicHeaderSize);
+  header.WriteU32(kFlicHeaderSize + frame_sizes[0]);
+  header.WriteBytes(bytearray(kFlicHeaderSize - header.pos()));
+
+  (*chunks)[0] = header.data();
+
+  return true;
+}
+
+bytearray FlicCodec::EncodeFrame(const Animation &animation, size_t index)
+{
+  const Frame &frame = animation.frames[index];
+  const Frame *previous = index ? &animation.frames[index - 1] : NULL;
+  uint16_t width = animation.width;
+  uint16_t height = animation.height;
+
+  MemoryBuffer palette_chunk;
+  EncodePalette(previous ? &previous->palette : NULL, frame.palette, &palette_chunk);
+
+  // Find the rectangle of pixels that changed, every pixel counts when the palette changes
+  uint32_t left = 0, top = 0, right = width - 1, bottom = height - 1;
+  bool changed = true;
+  if (previous && !palette_chunk.size()) {
+    const char *a = previous->pixels.data();
+    const char *b = frame.pixels.data();
+
+    top = height;
+    bottom = 0;
+    left = width;
+    right = 0;
+    for (uint32_t y = 0; y < height; y++) {
+      const char *ra = a + size_t(y) * width;
+      const char *rb = b + size_t(y) * width;
+      if (!memcmp(ra, rb, width)) {
+        continue;
+      }
+
+      top = std::min(top, y);
+      bottom = y;
+
+      uint32_t x = 0;
+      while (ra[x] == rb[x]) {
+        x++;
+      }
+      left = std::min(left, x);
+
+      x = width - 1;
+      while (ra[x] == rb[x]) {
+        x--;
+      }
+      right = std::max(right, x);
+    }
+
+    changed = top < height;
+  }
+
+  MemoryBuffer out;
+  out.WriteU32(1);
+  out.WriteU32(changed ? left : 0);
+  out.WriteU32(changed ? top : 0);
+  out.WriteU32(changed ? right : 0);
+  out.WriteU32(changed ? bottom : 0);
+
+  if (!changed) {
+    // Nothing to draw, SI stores this as the custom header alone
+    return out.data();
+  }
+
+  MemoryBuffer pixel_chunk;
+  uint16_t pixel_type = BYTE_RUN;
+  if (previous && memcmp(previous->pixels.data(), frame.pixels.data(), frame.pixels.size())) {
+    EncodeDelta(animation, *previous, frame, &pixel_chunk);
+    pixel_type = DELTA_FLC;
+
+    MemoryBuffer byte_run;
+    EncodeByteRun(animation, frame, &byte_run);
+    if (byte_run.size() < pixel_chunk.size()) {
+      pixel_chunk = byte_run;
+      pixel_type = BYTE_RUN;
+    }
+  } else if (!previous) {
+    EncodeByteRun(animation, frame, &pixel_chunk);
+  }
+
+  MemoryBuffer subchunks;
+  uint16_t count = 0;
+  if (palette_chunk.size()) {
+    WriteFlicChunk(&subchunks, COLOR_256, palette_chunk.data());
+    count++;
+  }
+  if (pixel_chunk.size()) {
+    WriteFlicChunk(&subchunks, pixel_type, pixel_chunk.data());
+    count++;
+  }
+
+  out.WriteU32(uint32_t(kFrameHeaderSize + subchunks.size()));
+  out.WriteU16(FRAME_TYPE);
+  out.WriteU16(count);
+  out.WriteU16(0); // delay
+  out.WriteU16(0); // reserved
+  out.WriteU16(0); // width
+  out.WriteU16(0); // height
+  out.WriteBytes(subchunks.data());
+
+  return out.data();
+}
+
+void FlicCodec::EncodePalette(const PaletteQuantizer::Palette *previous, const PaletteQuantizer::Palette &palette, MemoryBuffer *out)
+{
+  PaletteQuantizer::Color a[256], b[256];
+  PadPalette(palette, b);
+  if (previous) {
+    PadPalette(*previous, a);
+  }
+
+  MemoryBuffer packets;
+  uint16_t count = 0;
+  size_t index = 0;
+  while (index < 256) {
+    size_t start = index;
+    while (start < 256 && previous && SameColor(a[start], b[start])) {
+      start++;
+    }
+    if (start == 256) {
+      break;
+    }
+
+    size_t end = start + 1;
+    while (end < 256 && (!previous || !SameColor(a[end], b[end]))) {
+      end++;
+    }
+
+    packets.WriteU8(uint8_t(start - index));
+    packets.WriteU8(uint8_t(end - start)); // 256 wraps to 0, which means 256
+    for (size_t i = start; i < end; i++) {
+      packets.WriteU8(b[i].r);
+      packets.WriteU8(b[i].g);
+      packets.WriteU8(b[i].b);
+    }
+    count++;
+    index = end;
+  }
+
+  if (count) {
+    out->WriteU16(count);
+    out->WriteBytes(packets.data());
+  }
+}
+
+void FlicCodec::EncodeByteRun(const Animation &animation, const Frame &frame, MemoryBuffer *out)
+{
+  uint16_t width = animation.width;
+  bytearray line;
+
+  for (uint16_t y = 0; y < animation.height; y++) {
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(frame.pixels.data()) + size_t(y) * width;
+    MemoryBuffer packets;
+    size_t count = 0;
+
+    uint16_t x = 0;
+    while (x < width) {
+      int run = 1;
+      while (x + run < width && run < 127 && p[x + run] == p[x]) {
+        run++;
+      }
+
+      if (run >= 2) {
+        packets.WriteU8(uint8_t(run));
+        packets.WriteU8(p[x]);
+        x += run;
+      } else {
+        // Gather literals until a run of three or more starts, which is worth repeating
+        int n = 0;
+        while (x + n < width && n < 127) {
+          if (n > 0 && x + n + 2 < width && p[x + n] == p[x + n + 1] && p[x + n] == p[x + n + 2]) {
+            break;
+          }
+          n++;
+        }
+
+        packets.WriteU8(uint8_t(-n));
+        packets.WriteData(p + x, n);
+        x += n;
+      }
+      count++;
+    }
+
+    out->WriteU8(uint8_t(std::min(count, size_t(255))));
+    out->WriteBytes(packets.data());
+  }
+}
+
+void FlicCodec::EncodeDelta(const Animation &animation, const Frame &previous, const Frame &frame, MemoryBuffer *out)
+{
+  uint16_t width = animation.width;
+  size_t pairs = width / 2;
+
+  MemoryBuffer lines;
+  uint16_t line_count = 0;
+  uint32_t skip = 0;
+
+  for (uint16_t y = 0; y < animation.height; y++) {
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(frame.pixels.data()) + size_t(y) * width;
+    const uint8_t *q = reinterpret_cast<const uint8_t*>(previous.pixels.data()) + size_t(y) * width;
+
+    if (!memcmp(p, q, width)) {
+      skip++;
+      continue;
+    }
+
+    // Skip words are negative line counts, with the top two bits set
+    while (skip) {
+      uint32_t n = std::min(skip, uint32_t(0x4000));
+      lines.WriteU16(uint16_t(0x10000 - n));
+      skip -= n;
+    }
+
+    // The last pixel of an odd width line can't be reached with words
+    if ((width & 1) && p[width - 1] != q[width - 1]) {
+      lines.WriteU16(uint16_t(0x8000 | p[width - 1]));
+    }
+
+    MemoryBuffer packets;
+    uint16_t packet_count = 0;
+    size_t last = 0;
+    size_t x = 0;
+
+    while (x < pairs) {
+      if (p[x*2] == q[x*2] && p[x*2 + 1] == q[x*2 + 1]) {
+        x++;
+        continue;
+      }
+
+      // Column skips are in bytes and have to fit in one
+      while ((x - last) * 2 > 254) {
+        packets.WriteU8(254);
+        packets.WriteU8(0);
+        packet_count++;
+        last += 127;
+      }
+      uint8_t column_skip = uint8_t((x - last) * 2);
+
+      size_t run = 1;
+      while (x + run < pairs && run < 128 && p[(x + run)*2] == p[x*2] && p[(x + run)*2 + 1] == p[x*2 + 1]) {
+        run++;
+      }
+
+      if (run >= 2) {
+        packets.WriteU8(column_skip);
+        packets.WriteU8(uint8_t(-int(run)));
+        packets.WriteData(p + x*2, 2);
+        x += run;
+      } else {
+        // Copy until two unchanged words in a row make a skip worthwhile, or a run starts
+        size_t n = 0;
+        while (x + n < pairs && n < 127) {
+          if (n > 0) {
+            size_t i = x + n;
+            bool unchanged = p[i*2] == q[i*2] && p[i*2 + 1] == q[i*2 + 1];
+            bool next_unchanged = i + 1 >= pairs || (p[i*2 + 2] == q[i*2 + 2] && p[i*2 + 3] == q[i*2 + 3]);
+            if (unchanged && next_unchanged) {
+              break;
+            }
+            if (i + 2 < pairs
+                && p[i*2] == p[i*2 + 2] && p[i*2 + 1] == p[i*2 + 3]
+                && p[i*2] == p[i*2 + 4] && p[i*2 + 1] == p[i*2 + 5]) {
+              break;
+            }
+          }
+          n++;
+        }
+
+        packets.WriteU8(column_skip);
+        packets.WriteU8(uint8_t(n));
+        packets.WriteData(p + x*2, n * 2);
+        x += n;
+      }
+
+      packet_count++;
+      last = x;
+    }
+
+    lines.WriteU16(packet_count);
+    lines.WriteBytes(packets.data());
+    line_count++;
+  }
+
+  out->WriteU16(line_count);
+  out->WriteBytes(lines.data());
+}
+
+}
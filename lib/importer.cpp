@@ -0,0 +1,114 @@
+#include "importer.h"
+
+#include <algorithm>
+
+#include "extractor.h"
+#include "parallel.h"
+
+namespace si {
+
+class ImportJob : public ParallelJob
+{
+public:
+  ImportJob(ImportReport *report, int flags, size_t threads) :
+    report_(report),
+    staged_(report->results.size()),
+    flags_(flags),
+    threads_(threads)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    ImportReport::Result &r = report_->results[index];
+
+    // Replace a stand-in sharing the object's data, so conversions can match what it held
+    // without touching the object itself
+    Object staged;
+    staged.filetype_ = r.object->filetype_;
+    staged.data_ = r.object->data_;
+
+    File f;
+    r.replaced = f.Open(r.path.c_str(), File::Read)
+        && staged.ReplaceWithFile(&f, ChunkingPolicy(r.object->GetChunkingPolicy().buffer_size(), threads_), flags_);
+
+    if (r.replaced) {
+      staged_[index] = staged.data_;
+    }
+  }
+
+  const ChunkedData &staged(size_t index) const { return staged_[index]; }
+
+private:
+  ImportReport *report_;
+  std::vector<ChunkedData> staged_;
+  int flags_;
+
+  // Threads each file can use for its own conversion
+  size_t threads_;
+
+};
+
+bool FileExists(const std::string &path)
+{
+  File f;
+  return f.Open(path.c_str(), File::Read);
+}
+
+void Importer::ReplaceAll(Core *root, const std::string &directory, ImportReport *report, int flags, size_t threads)
+{
+  report->results.clear();
+  report->replaced = 0;
+  report->failed = 0;
+
+  CollectMatches(root, directory, report);
+
+  if (!threads) {
+    threads = Parallel::GetDefaultThreadCount();
+  }
+
+  // Files are already converted on the pool, so each only gets its share of it rather than
+  // starting a pool of its own on every thread
+  size_t per_file = std::max(size_t(1), threads / std::max(size_t(1), report->results.size()));
+
+  ImportJob job(report, flags, per_file);
+  Parallel::Run(&job, report->results.size(), threads);
+
+  for (size_t i = 0; i < report->results.size(); i++) {
+    ImportReport::Result &r = report->results[i];
+    if (r.replaced) {
+      r.object->data_ = job.staged(i);
+      r.object->MarkModified();
+      report->replaced++;
+    } else {
+      report->failed++;
+    }
+  }
+}
+
+void Importer::CollectMatches(Core *parent, const std::string &directory, ImportReport *report)
+{
+  for (size_t i = 0; i < parent->GetChildCount(); i++) {
+    Object *o = dynamic_cast<Object*>(parent->GetChildAt(i));
+    if (!o) {
+      continue;
+    }
+
+    if (!o->data().empty()) {
+      std::string path = directory + "/" + Extractor::GetFilename(o);
+      if (FileExists(path)) {
+        ImportReport::Result r;
+        r.object = o;
+        r.path = path;
+        r.replaced = false;
+        report->results.push_back(r);
+      }
+    }
+
+    if (o->HasChildren()) {
+      CollectMatches(o, directory + "/" + o->name(), report);
+    }
+  }
+}
+
+}
@@ -1,11 +1,16 @@
 #include "interleaf.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cwchar>
+#include <functional>
 #include <iostream>
 #include <sstream>
 
 #include "object.h"
 #include "othertypes.h"
+#include "parallel.h"
 #include "sitypes.h"
 #include "util.h"
 
@@ -15,16 +20,26 @@ static const uint32_t kMinimumChunkSize = 8;
 
 Interleaf::Interleaf()
 {
+  Clear();
 }
 
 void Interleaf::Clear()
 {
   m_Info.clear();
+  m_ChunkTable.clear();
+  m_Version = Version2_2;
   m_BufferSize = 0;
+  m_BufferCount = 0;
   m_JoiningProgress = 0;
   m_JoiningSize = 0;
   m_ObjectOffsetTable.clear();
   m_ObjectIDTable.clear();
+  m_StreamLayout.clear();
+  m_StreamLayoutBufferSize = 0;
+  m_OffsetTablePos = 0;
+  m_OffsetTableCount = 0;
+  m_StreamListPos = 0;
+  m_StreamListEnd = 0;
   DeleteChildren();
 }
 
@@ -37,13 +52,65 @@ Interleaf::Error Interleaf::Read(const char *f, int flags)
   return Read(&is, flags);
 }
 
-Interleaf::Error Interleaf::Write(const char *f) const
+Interleaf::Error Interleaf::Write(const char *f, int flags)
+{
+  File os;
+  if (!os.Open(f, File::Write)) {
+    return ERROR_IO;
+  }
+  return Write(&os, flags);
+}
+
+Interleaf::Error Interleaf::Write(const char *f, int flags) const
 {
   File os;
   if (!os.Open(f, File::Write)) {
     return ERROR_IO;
   }
-  return Write(&os);
+  return Write(&os, flags);
+}
+
+Interleaf::Error Interleaf::WriteModified(const char *f)
+{
+  if (!HasStreamLayout()) {
+    return Write(f);
+  }
+
+  File os;
+  if (!os.Open(f, File::ReadWrite)) {
+    return ERROR_IO;
+  }
+  return WriteModified(&os);
+}
+
+Interleaf::Error Interleaf::WriteCopyingUnchanged(const char *f, const char *source, int flags)
+{
+  // Opening the target for writing would truncate the source before its ranges are copied
+  if (!strcmp(f, source) || File::IsSameFile(f, source)) {
+    return WriteModified(f);
+  }
+
+  std::vector<File::Range> copies;
+  WrittenLayout layout;
+  Error e;
+
+  {
+    File os;
+    if (!os.Open(f, File::Write)) {
+      return ERROR_IO;
+    }
+    e = WriteWithCopies(&os, flags, &copies, &layout);
+  }
+
+  if (e == ERROR_SUCCESS && !File::CopyRanges(source, f, copies)) {
+    e = ERROR_IO;
+  }
+
+  if (e == ERROR_SUCCESS) {
+    RecordLayout(&layout);
+  }
+
+  return e;
 }
 
 #ifdef _WIN32
@@ -56,17 +123,68 @@ Interleaf::Error Interleaf::Read(const wchar_t *f, int flags)
   return Read(&is, flags);
 }
 
-Interleaf::Error Interleaf::Write(const wchar_t *f) const
+Interleaf::Error Interleaf::Write(const wchar_t *f, int flags)
+{
+  File os;
+  if (!os.Open(f, File::Write)) {
+    return ERROR_IO;
+  }
+  return Write(&os, flags);
+}
+
+Interleaf::Error Interleaf::Write(const wchar_t *f, int flags) const
 {
   File os;
   if (!os.Open(f, File::Write)) {
     return ERROR_IO;
   }
-  return Write(&os);
+  return Write(&os, flags);
+}
+
+Interleaf::Error Interleaf::WriteModified(const wchar_t *f)
+{
+  if (!HasStreamLayout()) {
+    return Write(f);
+  }
+
+  File os;
+  if (!os.Open(f, File::ReadWrite)) {
+    return ERROR_IO;
+  }
+  return WriteModified(&os);
+}
+
+Interleaf::Error Interleaf::WriteCopyingUnchanged(const wchar_t *f, const wchar_t *source, int flags)
+{
+  if (!wcscmp(f, source) || File::IsSameFile(f, source)) {
+    return WriteModified(f);
+  }
+
+  std::vector<File::Range> copies;
+  WrittenLayout layout;
+  Error e;
+
+  {
+    File os;
+    if (!os.Open(f, File::Write)) {
+      return ERROR_IO;
+    }
+    e = WriteWithCopies(&os, flags, &copies, &layout);
+  }
+
+  if (e == ERROR_SUCCESS && !File::CopyRanges(source, f, copies)) {
+    e = ERROR_IO;
+  }
+
+  if (e == ERROR_SUCCESS) {
+    RecordLayout(&layout);
+  }
+
+  return e;
 }
 #endif
 
-Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
+Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info, uint32_t chunk)
 {
   uint32_t offset = f->pos();
   uint32_t id = f->ReadU32();
@@ -79,9 +197,16 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
     info->SetSize(size);
   }
 
+  if (chunk != ChunkTable::NONE) {
+    ChunkTable::Chunk &c = m_ChunkTable.chunks_[chunk];
+    c.type = id;
+    c.offset = offset;
+    c.size = size;
+  }
+
   std::stringstream real_desc;
   NullStream null_desc;
-  std::ostream& desc = info ? (std::ostream&) real_desc : (std::ostream&) null_desc;
+  std::ostream& desc = (info || chunk != ChunkTable::NONE) ? (std::ostream&) real_desc : (std::ostream&) null_desc;
 
   switch (static_cast<RIFF::Type>(id)) {
   case RIFF::RIFF_:
@@ -117,6 +242,8 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
     desc << "Count: " << offset_count;
 
     uint32_t real_count = (size - sizeof(uint32_t)) / sizeof(uint32_t);
+    m_OffsetTablePos = f->pos();
+    m_OffsetTableCount = real_count;
     for (uint32_t i = 0; i < real_count; i++) {
       Object *o = new Object();
       parent->AppendChild(o);
@@ -134,7 +261,10 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
     uint32_t list_type = f->ReadU32();
     desc << "Type: " << RIFF::PrintU32AsString(list_type) << std::endl;
     uint32_t list_count = 0;
-    if (list_type == RIFF::MxCh) {
+    if (list_type == RIFF::MxSt) {
+      m_StreamListPos = offset;
+      m_StreamListEnd = end;
+    } else if (list_type == RIFF::MxCh) {
       if (m_Version == Version2_1) {
         uint32_t unknown_list_entry = f->ReadU32();
         desc << "Unknown v2.1 list entry: " << unknown_list_entry << std::endl;
@@ -186,13 +316,17 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
       parent->AppendChild(o);
     }
 
+    // Objects are in the tree before their IDs are known
+    uint32_t old_id = o->id();
     ReadObject(f, o, desc);
+    ReindexObject(o, old_id);
 
     if (info) {
       info->SetObjectID(o->id());
     }
-
-    m_ObjectIDTable[o->id()] = o;
+    if (chunk != ChunkTable::NONE) {
+      m_ChunkTable.chunks_[chunk].object_id = o->id();
+    }
 
     parent = o;
     break;
@@ -211,6 +345,14 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
     uint32_t data_sz = f->ReadU32();
     desc << "Size: " << data_sz << std::endl;
 
+    if (info) {
+      info->SetObjectID(object);
+      info->SetDataLocation(f->pos(), size - MxCh::HEADER_SIZE);
+    }
+    if (chunk != ChunkTable::NONE) {
+      m_ChunkTable.chunks_[chunk].object_id = object;
+    }
+
     if (!(m_readFlags & IncludeData)) {
       f->seek(size - MxCh::HEADER_SIZE, FileBase::SeekCurrent);
       break;
@@ -218,21 +360,14 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
 
     bytearray data = f->ReadBytes(size - MxCh::HEADER_SIZE);
 
-    if (info) {
-      info->SetObjectID(object);
-      info->SetData(data);
-    }
-
     if (!(flags & MxCh::FLAG_END)) {
-      std::map<uint32_t, Object*>::iterator it = m_ObjectIDTable.find(object);
-      if (it == m_ObjectIDTable.end()) {
+      Object *o = GetObjectByID(object);
+      if (!o) {
         LogError() << "Failed to find object " << object << " for chunk at " << std::hex << offset << std::dec << std::endl;
         //return ERROR_INVALID_INPUT;
       } else {
-        Object *o = it->second;
-
         if (flags & MxCh::FLAG_SPLIT && m_JoiningSize > 0) {
-          o->data_.back().append(data);
+          o->data_.Modify(o->data_.size() - 1).append(data);
 
           m_JoiningProgress += data.size();
           if (m_JoiningProgress == m_JoiningSize) {
@@ -258,6 +393,7 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
   }
 
   // Assume any remaining data is this chunk's children
+  uint32_t previous = ChunkTable::NONE;
   while (!f->atEnd() && (f->pos() + kMinimumChunkSize) < end) {
     // Check alignment, if there's not enough room to for another segment, skip ahead
     if (m_BufferSize > 0) {
@@ -273,7 +409,12 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
       subinfo = new Info();
       info->AppendChild(subinfo);
     }
-    Error e = ReadChunk(parent, f, subinfo);
+    uint32_t subchunk = ChunkTable::NONE;
+    if (chunk != ChunkTable::NONE) {
+      subchunk = m_ChunkTable.Append(chunk, previous);
+      previous = subchunk;
+    }
+    Error e = ReadChunk(parent, f, subinfo, subchunk);
     if (e != ERROR_SUCCESS) {
       return e;
     }
@@ -282,6 +423,9 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
   if (info) {
     info->SetDescription(real_desc.str());
   }
+  if (chunk != ChunkTable::NONE) {
+    m_ChunkTable.SetDescription(chunk, real_desc.str());
+  }
 
   if (f->pos() < end) {
     f->seek(end, File::SeekStart);
@@ -308,6 +452,117 @@ Interleaf::Error Interleaf::ReadChunk(Core *parent, FileBase *f, Info *info)
   return ERROR_SUCCESS;
 }
 
+Object *Interleaf::GetObjectByID(uint32_t id) const
+{
+  // If an ID is shared, the object that took it last wins, as it always has while reading
+  ObjectIndex::const_iterator it = m_ObjectIDTable.upper_bound(id);
+  if (it == m_ObjectIDTable.begin()) {
+    return NULL;
+  }
+  it--;
+  return (it->first == id) ? it->second : NULL;
+}
+
+Object *Interleaf::GetObjectByID(uint32_t id, bool *shared) const
+{
+  std::pair<ObjectIndex::const_iterator, ObjectIndex::const_iterator> range = m_ObjectIDTable.equal_range(id);
+  if (range.first == range.second) {
+    *shared = false;
+    return NULL;
+  }
+
+  ObjectIndex::const_iterator last = range.second;
+  last--;
+  *shared = (last != range.first);
+  return last->second;
+}
+
+bool Interleaf::GetObjectPath(uint32_t id, std::vector<Object*> *path) const
+{
+  path->clear();
+
+  Object *o = GetObjectByID(id);
+  if (!o) {
+    return false;
+  }
+
+  for (Core *c = o; c != this; c = c->GetParent()) {
+    path->push_back(static_cast<Object*>(c));
+  }
+  std::reverse(path->begin(), path->end());
+  return true;
+}
+
+void Interleaf::SetObjectID(Object *o, uint32_t id)
+{
+  uint32_t old_id = o->id();
+  o->id_ = id;
+  if (o->GetRoot() == this) {
+    ReindexObject(o, old_id);
+  }
+}
+
+void Interleaf::OnDescendantAdded(Core *child)
+{
+  IndexObjects(child);
+
+  if (Object *parent = dynamic_cast<Object*>(child->GetParent())) {
+    parent->InvalidateDiskSize();
+  }
+}
+
+void Interleaf::OnDescendantRemoved(Core *child)
+{
+  UnindexObjects(child);
+
+  if (Object *parent = dynamic_cast<Object*>(child->GetParent())) {
+    parent->InvalidateDiskSize();
+  }
+}
+
+void Interleaf::IndexObjects(Core *c)
+{
+  // Objects that haven't been read yet don't have an ID, they're indexed once they do
+  Object *o = static_cast<Object*>(c);
+  if (o->type() != MxOb::Null) {
+    m_ObjectIDTable.insert(std::make_pair(o->id(), o));
+  }
+
+  for (size_t i = 0; i < c->GetChildCount(); i++) {
+    IndexObjects(c->GetChildAt(i));
+  }
+}
+
+void Interleaf::UnindexObjects(Core *c)
+{
+  Object *o = static_cast<Object*>(c);
+  EraseFromIndex(o, o->id());
+
+  for (size_t i = 0; i < c->GetChildCount(); i++) {
+    UnindexObjects(c->GetChildAt(i));
+  }
+}
+
+void Interleaf::ReindexObject(Object *o, uint32_t old_id)
+{
+  EraseFromIndex(o, old_id);
+  if (o->type() != MxOb::Null) {
+    m_ObjectIDTable.insert(std::make_pair(o->id(), o));
+  }
+}
+
+void Interleaf::EraseFromIndex(Object *o, uint32_t id)
+{
+  // Other objects may share the ID, only this one's entry goes
+  std::pair<ObjectIndex::iterator, ObjectIndex::iterator> range = m_ObjectIDTable.equal_range(id);
+  for (ObjectIndex::iterator it = range.first; it != range.second; it++) {
+    if (it->second == o) {
+      m_ObjectIDTable.erase(it);
+      return;
+    }
+  }
+}
+
 Object *Interleaf::ReadObject(FileBase *f, Object *o, std::ostream &desc)
 {
   o->type_ = static_cast<MxOb::Type>(f->ReadU16());
@@ -367,6 +622,8 @@ Object *Interleaf::ReadObject(FileBase *f, Object *o, std::ostream &desc)
     }
   }
 
+  o->InvalidateDiskSize();
+
   return o;
 }
 
@@ -374,24 +631,410 @@ Interleaf::Error Interleaf::Read(FileBase *f, int flags)
 {
   Clear();
   m_readFlags = flags;
-  return ReadChunk(this, f, m_readFlags & IncludeInfo ?  &m_Info : NULL);
+
+  uint32_t chunk = ChunkTable::NONE;
+  if (m_readFlags & IncludeChunkTable) {
+    chunk = m_ChunkTable.Append(ChunkTable::NONE, ChunkTable::NONE);
+  }
+
+  Error e = ReadChunk(this, f, m_readFlags & IncludeInfo ?  &m_Info : NULL, chunk);
+  if (e == ERROR_SUCCESS) {
+    ReadStreamLayout(f);
+  }
+  return e;
+}
+
+void Interleaf::ReadStreamLayout(FileBase *f)
+{
+  // Modified streams can only be written back in place if we know where everything is, and
+  // the stream list is the last thing in the file so new streams can be added to the end
+  f->seek(sizeof(uint32_t), FileBase::SeekStart);
+  uint32_t riff_end = f->ReadU32() + kMinimumChunkSize;
+  if (!m_StreamListPos || m_StreamListEnd != riff_end || m_OffsetTableCount != GetChildCount()) {
+    return;
+  }
+
+  m_StreamLayout.resize(GetChildCount());
+  m_StreamLayoutBufferSize = m_BufferSize;
+  for (size_t i = 0; i < m_StreamLayout.size(); i++) {
+    m_StreamLayout[i].offset = 0;
+  }
+
+  for (std::map<uint32_t, Object*>::const_iterator it = m_ObjectOffsetTable.begin(); it != m_ObjectOffsetTable.end(); it++) {
+    StreamSpan &span = m_StreamLayout[IndexOfChild(it->second)];
+
+    f->seek(it->first + sizeof(uint32_t), FileBase::SeekStart);
+    uint32_t size = f->ReadU32();
+
+    std::map<uint32_t, Object*>::const_iterator next = it;
+    next++;
+
+    span.offset = it->first;
+    span.end = it->first + kMinimumChunkSize + size + size%2;
+    span.limit = (next == m_ObjectOffsetTable.end()) ? m_StreamListEnd : next->first;
+  }
 }
 
-void RecursivelyAddObjectToList(std::vector<Object*> *list, Object *o)
+static const size_t kNoParent = size_t(-1);
+
+struct ChunkStatus
+{
+  Object *object;
+  size_t index;
+  uint32_t time;
+
+  // Index of this object's parent in the status list (kNoParent if it isn't being interleaved)
+  size_t parent;
+
+  // Number of direct children that still have chunks to write. An object can't be written
+  // until this reaches 0.
+  size_t pending;
+
+  bool active;
+};
+
+// Earliest time first, ties go to whichever object was listed first. Kept as a heap with
+// std::greater so the vector can be reused between streams.
+typedef std::pair<uint32_t, size_t> ChunkQueueEntry;
+
+// One MxCh in the order InterleaveObjects() picked, enough to write it again without picking
+struct Interleaf::ScheduledChunk
+{
+  const Object *object;
+
+  // Which of the object's chunks, unused for end chunks
+  size_t index;
+
+  uint32_t time;
+  uint16_t flags;
+};
+
+// Working memory for writing streams, reused from one stream to the next so the write path
+// doesn't have to allocate for every stream or chunk
+struct Interleaf::WriteScratch
+{
+  WriteScratch(int write_flags = 0)
+  {
+    flags = write_flags;
+    report = NULL;
+    schedule = NULL;
+    replay = NULL;
+    replay_begin = 0;
+    replay_end = 0;
+  }
+
+  int flags;
+  std::vector<ChunkStatus> status;
+  std::vector<ChunkQueueEntry> queue;
+
+  // Set when planning, see Interleaf::PlanLayout()
+  LayoutReport *report;
+
+  // If set, every chunk written is noted here too
+  std::vector<ScheduledChunk> *schedule;
+
+  // If set, streams are written from this range of an earlier schedule instead of interleaving
+  const std::vector<ScheduledChunk> *replay;
+  size_t replay_begin;
+  size_t replay_end;
+};
+
+// Filled once at startup, padding is written from this in pieces instead of being allocated
+struct PaddingBlock
 {
-  list->push_back(o);
+  PaddingBlock()
+  {
+    memset(data, 0xCD, sizeof(data));
+  }
+
+  char data[4096];
+};
+
+static const PaddingBlock kPaddingBlock;
+
+
+void RecursivelyAddObjectToList(std::vector<ChunkStatus> *list, Object *o, size_t parent)
+{
+  size_t index = list->size();
+
+  ChunkStatus s;
+  s.object = o;
+  s.index = 0;
+  s.time = o->time_offset_;
+  s.parent = parent;
+  s.pending = 0;
+  s.active = true;
+  list->push_back(s);
+
   for (size_t j=0; j<o->GetChildCount(); j++) {
-    RecursivelyAddObjectToList(list, static_cast<Object*>(o->GetChildAt(j)));
+    RecursivelyAddObjectToList(list, static_cast<Object*>(o->GetChildAt(j)), index);
+  }
+}
+
+// Holds a stream in memory as if it had been written to a file at `base`, so that buffer
+// alignment comes out exactly the same as it would have in the file
+class StreamBuffer : public FileBase
+{
+public:
+  StreamBuffer(pos_t base, size_t expected_size = 0)
+  {
+    m_Base = base;
+    m_Position = 0;
+    m_Internal.reserve(expected_size);
+  }
+
+  const bytearray &data() const { return m_Internal; }
+  void TakeData(bytearray *out) { out->swap(m_Internal); }
+
+  virtual pos_t pos() { return m_Base + m_Position; }
+  virtual pos_t size() { return m_Base + m_Internal.size(); }
+
+  virtual void seek(pos_t p, SeekMode s = SeekStart)
+  {
+    // Like a file, seeking past the end is allowed and gets filled in by the next write
+    switch (s) {
+    case SeekStart:
+      m_Position = p - m_Base;
+      break;
+    case SeekCurrent:
+      m_Position += p;
+      break;
+    case SeekEnd:
+      m_Position = m_Internal.size() - p;
+      break;
+    }
+  }
+
+  virtual pos_t ReadData(void *data, pos_t size) { return 0; }
+
+  virtual pos_t WriteData(const void *data, pos_t size)
+  {
+    pos_t end = m_Position + size;
+    if (end > m_Internal.size()) {
+      m_Internal.resize(end);
+    }
+    memcpy(m_Internal.data() + m_Position, data, size);
+    m_Position += size;
+    return size;
+  }
+
+private:
+  bytearray m_Internal;
+  pos_t m_Base;
+  pos_t m_Position;
+
+};
+
+// Tracks where writes would go without storing anything, for working out a layout up front
+class CountingBuffer : public FileBase
+{
+public:
+  CountingBuffer(pos_t start)
+  {
+    m_Position = start;
+    m_Size = start;
+  }
+
+  virtual pos_t pos() { return m_Position; }
+  virtual pos_t size() { return m_Size; }
+
+  virtual void seek(pos_t p, SeekMode s = SeekStart)
+  {
+    switch (s) {
+    case SeekStart:
+      m_Position = p;
+      break;
+    case SeekCurrent:
+      m_Position += p;
+      break;
+    case SeekEnd:
+      m_Position = m_Size - p;
+      break;
+    }
+  }
+
+  virtual pos_t ReadData(void *data, pos_t size) { return 0; }
+
+  virtual pos_t WriteData(const void *data, pos_t size)
+  {
+    m_Position += size;
+    m_Size = std::max(m_Size, m_Position);
+    return size;
+  }
+
+private:
+  pos_t m_Position;
+  pos_t m_Size;
+
+};
+
+void CountObjectsAndChunks(const Object *o, size_t *objects, size_t *chunks)
+{
+  // Every object ends with an end chunk, split chunks aren't known until they're written
+  (*objects)++;
+  *chunks += o->data().size() + 1;
+
+  for (size_t i = 0; i < o->GetChildCount(); i++) {
+    CountObjectsAndChunks(static_cast<const Object*>(o->GetChildAt(i)), objects, chunks);
+  }
+}
+
+Interleaf::Error Interleaf::PlanLayout(LayoutReport *report, int flags) const
+{
+  report->file_size = 0;
+  report->buffer_size = m_BufferSize;
+  report->buffer_count = m_BufferCount;
+  report->streams.clear();
+  report->objects.clear();
+  report->padding_bytes = 0;
+  report->padding_chunks = 0;
+  report->chunks = 0;
+  report->split_chunks = 0;
+  report->chunk_placements.clear();
+
+  // Make room up front so recording doesn't have to allocate as it goes
+  size_t objects = 0;
+  size_t chunks = 0;
+  for (size_t i = 0; i < GetChildCount(); i++) {
+    CountObjectsAndChunks(static_cast<const Object*>(GetChildAt(i)), &objects, &chunks);
+  }
+  report->streams.reserve(GetChildCount());
+  report->objects.reserve(objects);
+  report->chunk_placements.reserve(chunks);
+
+  // Parallel writes go through separate buffers that wouldn't be counted, and the result is the
+  // same anyway
+  CountingBuffer counter(0);
+  Error e = WriteWithCopies(&counter, flags & ~WriteParallel, NULL, NULL, report);
+
+  report->file_size = counter.size();
+
+  return e;
+}
+
+// Serializes a batch of top-level streams at once, each into its own buffer at the offset and
+// in the chunk order the planning pass worked out for it
+class SerializeStreamsJob : public ParallelJob
+{
+public:
+  SerializeStreamsJob(const Interleaf *interleaf, int flags)
+  {
+    m_Interleaf = interleaf;
+    m_Flags = flags;
+  }
+
+  // Returns where the stream's chunks should be noted while it's planned
+  std::vector<Interleaf::ScheduledChunk> *Add(const Object *o, uint32_t offset)
+  {
+    m_Objects.push_back(o);
+    m_Offsets.push_back(offset);
+    m_Sizes.push_back(0);
+    m_ScheduleStarts.push_back(m_Schedule.size());
+    return &m_Schedule;
+  }
+
+  // Size of the stream added last, once it's planned, so its buffer never has to grow
+  void SetPlannedSize(uint32_t size) { m_Sizes.back() = size; }
+
+  void Clear()
+  {
+    m_Objects.clear();
+    m_Offsets.clear();
+    m_Sizes.clear();
+    m_ScheduleStarts.clear();
+    m_Schedule.clear();
+    m_Results.clear();
+  }
+
+  size_t GetCount() const { return m_Objects.size(); }
+
+  bytearray &GetResult(size_t i) { return m_Results.at(i); }
+
+  void RunAll()
+  {
+    m_Results.resize(m_Objects.size());
+    Parallel::Run(this, m_Objects.size());
+  }
+
+  virtual void Run(size_t index)
+  {
+    Interleaf::WriteScratch scratch(m_Flags);
+    scratch.replay = &m_Schedule;
+    scratch.replay_begin = m_ScheduleStarts[index];
+    scratch.replay_end = (index + 1 < m_ScheduleStarts.size()) ? m_ScheduleStarts[index + 1] : m_Schedule.size();
+
+    StreamBuffer buf(m_Offsets[index], m_Sizes[index]);
+    m_Interleaf->WriteStream(&buf, m_Objects[index], &scratch);
+    buf.TakeData(&m_Results[index]);
+  }
+
+private:
+  const Interleaf *m_Interleaf;
+  int m_Flags;
+  std::vector<const Object*> m_Objects;
+  std::vector<uint32_t> m_Offsets;
+  std::vector<uint32_t> m_Sizes;
+  std::vector<size_t> m_ScheduleStarts;
+  std::vector<Interleaf::ScheduledChunk> m_Schedule;
+  std::vector<bytearray> m_Results;
+
+};
+
+Interleaf::Error Interleaf::Write(FileBase *f, int flags)
+{
+  WrittenLayout layout;
+  Error e = WriteWithCopies(f, flags, NULL, &layout);
+  if (e == ERROR_SUCCESS) {
+    RecordLayout(&layout);
+  }
+  return e;
+}
+
+Interleaf::Error Interleaf::Write(FileBase *f, int flags) const
+{
+  return WriteWithCopies(f, flags, NULL, NULL);
+}
+
+void Interleaf::RecordLayout(WrittenLayout *layout)
+{
+  // Remember where everything went so modified streams can be written back in place later
+  m_StreamLayout.swap(layout->streams);
+  m_StreamLayoutBufferSize = m_BufferSize;
+  m_OffsetTablePos = layout->offset_table_pos;
+  m_OffsetTableCount = GetChildCount();
+  m_StreamListPos = layout->stream_list_pos;
+  m_StreamListEnd = layout->stream_list_end;
+
+  for (size_t i = 0; i < GetChildCount(); i++) {
+    static_cast<Object*>(GetChildAt(i))->ClearModified();
+  }
+}
+
+uint32_t Interleaf::GetCopyableStreamSize(size_t i, uint32_t offset) const
+{
+  // An unmodified stream can be copied as-is from the file it was read from or written to, as
+  // long as it lands in the same place relative to the buffer boundaries it was written for
+  if (!HasStreamLayout() || static_cast<const Object*>(GetChildAt(i))->IsModified()) {
+    return 0;
+  }
+
+  const StreamSpan &span = m_StreamLayout[i];
+  if (!span.offset || span.offset % m_BufferSize != offset % m_BufferSize) {
+    return 0;
   }
+
+  return span.end - span.offset;
 }
 
-Interleaf::Error Interleaf::Write(FileBase *f) const
+Interleaf::Error Interleaf::WriteWithCopies(FileBase *f, int flags, std::vector<File::Range> *copies, WrittenLayout *layout, LayoutReport *report) const
 {
   if (m_BufferSize == 0) {
     LogError() << "Buffer size must be set to write" << std::endl;
     return ERROR_INVALID_BUFFER_SIZE;
   }
 
+  UpdateDiskSizes();
+
   RIFF::Chk riff = RIFF::BeginChunk(f, RIFF::RIFF_);
   f->WriteU32(RIFF::OMNI);
 
@@ -423,20 +1066,34 @@ Interleaf::Error Interleaf::Write(FileBase *f) const
     RIFF::EndChunk(f, mxof);
   }
 
+  // Only filled in if the caller wants to record it
+  std::vector<StreamSpan> spans(layout ? GetChildCount() : 0);
+  uint32_t stream_list_pos = f->pos();
+
   {
     // LIST
     RIFF::Chk list_mxst = RIFF::BeginChunk(f, RIFF::LIST);
 
     f->WriteU32(RIFF::MxSt);
 
+    // Streams only depend on where they start, so once that's known for each of them they can
+    // all be serialized at the same time
+    WriteScratch scratch(flags);
+    scratch.report = report;
+    SerializeStreamsJob parallel_job(this, flags);
+    size_t parallel_batch_end = 0;
+    size_t parallel_batch_index = 0;
+
+    StreamSpan *last_span = NULL;
+
     for (size_t i = 0; i < GetChildCount(); i++) {
       Object *child = static_cast<Object*>(GetChildAt(i));
       if (child->type() == MxOb::Null) {
         continue;
       }
 
-      size_t maxSz = child->CalculateMaximumDiskSize() + kMinimumChunkSize;
-      WritePaddingIfNecessary(f, maxSz);
+      size_t maxSz = child->GetMaximumDiskSize() + kMinimumChunkSize;
+      WritePaddingIfNecessary(f, maxSz, report);
 
       uint32_t mxst_offset = f->pos();
 
@@ -444,31 +1101,72 @@ Interleaf::Error Interleaf::Write(FileBase *f) const
       f->WriteU32(mxst_offset);
       f->seek(mxst_offset);
 
-      // MxSt
-      RIFF::Chk mxst = RIFF::BeginChunk(f, RIFF::MxSt);
+      uint32_t copy_size = copies ? GetCopyableStreamSize(i, mxst_offset) : 0;
+
+      if (copy_size) {
+        // Leave a hole for it, the caller fills it in from the source file afterwards
+        File::Range r = {m_StreamLayout[i].offset, mxst_offset, copy_size};
+        copies->push_back(r);
+        f->seek(mxst_offset + copy_size);
+      } else if (flags & WriteParallel) {
+        if (i >= parallel_batch_end) {
+          // Keep a few streams per thread in memory at a time
+          size_t batch_size = Parallel::GetDefaultThreadCount() * 2;
+
+          // Plan the batch without writing anything. That takes picking the order of every chunk,
+          // which is noted so serializing them doesn't have to do it again, while working out
+          // where each of them goes only takes adding up sizes.
+          CountingBuffer counter(mxst_offset);
+
+          parallel_job.Clear();
+          for (parallel_batch_end = i; parallel_batch_end < GetChildCount() && parallel_job.GetCount() < batch_size; parallel_batch_end++) {
+            Object *o = static_cast<Object*>(GetChildAt(parallel_batch_end));
+            if (o->type() == MxOb::Null) {
+              continue;
+            }
 
-      {
-        // MxOb
-        WriteObject(f, child);
-      }
+            if (parallel_batch_end != i) {
+              WritePaddingIfNecessary(&counter, o->GetMaximumDiskSize() + kMinimumChunkSize);
+            }
 
-      {
-        // LIST
-        RIFF::Chk list_mxda = RIFF::BeginChunk(f, RIFF::LIST);
+            uint32_t offset = counter.pos();
+            uint32_t copy_size = copies ? GetCopyableStreamSize(parallel_batch_end, offset) : 0;
+            if (copy_size) {
+              counter.seek(offset + copy_size);
+              continue;
+            }
 
-        f->WriteU32(RIFF::MxDa);
+            scratch.schedule = parallel_job.Add(o, offset);
+            WriteStream(&counter, o, &scratch);
+            parallel_job.SetPlannedSize(uint32_t(counter.pos()) - offset);
+          }
+          scratch.schedule = NULL;
 
-        // First, interleave headers
-        std::vector<Object*> objects;
-        objects.reserve(child->GetChildCount() + 1);
-        RecursivelyAddObjectToList(&objects, child);
+          parallel_job.RunAll();
+          parallel_batch_index = 0;
+        }
 
-        InterleaveObjects(f, objects);
+        bytearray &stream = parallel_job.GetResult(parallel_batch_index);
+        f->WriteBytes(stream);
+        bytearray().swap(stream);
+        parallel_batch_index++;
+      } else {
+        WriteStream(f, child, &scratch);
+      }
 
-        RIFF::EndChunk(f, list_mxda);
+      if (report) {
+        LayoutReport::Placement p = {child->id(), mxst_offset, uint32_t(f->pos()) - mxst_offset};
+        report->streams.push_back(p);
       }
 
-      RIFF::EndChunk(f, mxst);
+      if (layout) {
+        if (last_span) {
+          last_span->limit = mxst_offset;
+        }
+        last_span = &spans[i];
+        last_span->offset = mxst_offset;
+        last_span->end = f->pos();
+      }
     }
 
     // Fill remainder with padding
@@ -476,7 +1174,18 @@ Interleaf::Error Interleaf::Write(FileBase *f) const
       uint32_t current_buf = f->pos() / m_BufferSize;
       uint32_t target_sz = (current_buf + 1) * m_BufferSize;
 
-      WritePadding(f, target_sz - f->pos());
+      WritePadding(f, target_sz - f->pos(), report);
+    }
+
+    if (last_span) {
+      last_span->limit = f->pos();
+    }
+
+    if (layout) {
+      layout->streams.swap(spans);
+      layout->offset_table_pos = offset_table_pos;
+      layout->stream_list_pos = stream_list_pos;
+      layout->stream_list_end = f->pos();
     }
 
     RIFF::EndChunk(f, list_mxst);
@@ -487,9 +1196,164 @@ Interleaf::Error Interleaf::Write(FileBase *f) const
   return ERROR_SUCCESS;
 }
 
-void Interleaf::WriteObject(FileBase *f, const Object *o) const
+void Interleaf::UpdateDiskSizes() const
+{
+  // Sizes are worked out the first time they're asked for, so do that here before any of the
+  // threads writing streams can ask at once
+  for (size_t i = 0; i < GetChildCount(); i++) {
+    static_cast<const Object*>(GetChildAt(i))->GetMaximumDiskSize();
+  }
+}
+
+void Interleaf::WriteStream(FileBase *f, const Object *o, WriteScratch *scratch) const
+{
+  // MxSt
+  RIFF::Chk mxst = RIFF::BeginChunk(f, RIFF::MxSt);
+
+  {
+    // MxOb
+    WriteObject(f, o, scratch->report);
+  }
+
+  {
+    // LIST
+    RIFF::Chk list_mxda = RIFF::BeginChunk(f, RIFF::LIST);
+
+    f->WriteU32(RIFF::MxDa);
+
+    if (scratch->replay) {
+      for (size_t i = scratch->replay_begin; i < scratch->replay_end; i++) {
+        WriteScheduledChunk(f, scratch, (*scratch->replay)[i]);
+      }
+    } else {
+      scratch->status.clear();
+      RecursivelyAddObjectToList(&scratch->status, const_cast<Object*>(o), kNoParent);
+
+      InterleaveObjects(f, scratch);
+    }
+
+    RIFF::EndChunk(f, list_mxda);
+  }
+
+  RIFF::EndChunk(f, mxst);
+}
+
+Interleaf::Error Interleaf::WriteModified(FileBase *f)
+{
+  if (m_BufferSize == 0) {
+    LogError() << "Buffer size must be set to write" << std::endl;
+    return ERROR_INVALID_BUFFER_SIZE;
+  }
+
+  if (!HasStreamLayout()) {
+    // Everything would have to be written, but a shorter file would leave the end of the old
+    // one behind
+    LogError() << "Where streams are in the file isn't known, write it in full instead" << std::endl;
+    return ERROR_INVALID_INPUT;
+  }
+
+  UpdateDiskSizes();
+
+  uint32_t list_end = m_StreamListEnd;
+  WriteScratch scratch;
+
+  for (size_t i = 0; i < GetChildCount(); i++) {
+    Object *child = static_cast<Object*>(GetChildAt(i));
+    if (child->type() == MxOb::Null || !child->IsModified()) {
+      continue;
+    }
+
+    StreamSpan &span = m_StreamLayout[i];
+    size_t maxSz = child->GetMaximumDiskSize() + kMinimumChunkSize;
+
+    if (span.offset) {
+      // Try writing it back where it was. The header has to fit the same way it would have in a
+      // full write, and whatever's left before the next stream has to be fillable with padding.
+      // The last stream is free to grow into the end of the file.
+      if (span.offset/m_BufferSize == (span.offset + maxSz)/m_BufferSize) {
+        StreamBuffer buf(span.offset);
+        WriteStream(&buf, child, &scratch);
+
+        uint32_t new_end = buf.size();
+        bool grows_at_end = (span.limit == list_end && new_end > span.limit);
+
+        if (grows_at_end || (new_end <= span.limit && CanPadTo(new_end, span.limit))) {
+          f->seek(span.offset);
+          f->WriteBytes(buf.data());
+
+          if (grows_at_end) {
+            list_end = new_end;
+            span.limit = new_end;
+          } else {
+            WritePaddingTo(f, span.limit);
+          }
+
+          span.end = new_end;
+          child->ClearModified();
+          continue;
+        }
+      }
+
+      // It doesn't fit anymore, so hide the old copy behind padding and move it to the end
+      f->seek(span.offset);
+      WritePaddingTo(f, span.limit);
+    }
+
+    f->seek(list_end);
+    WritePaddingIfNecessary(f, maxSz);
+
+    uint32_t mxst_offset = f->pos();
+    WriteStream(f, child, &scratch);
+    child->ClearModified();
+
+    span.offset = mxst_offset;
+    span.end = f->pos();
+    span.limit = span.end;
+    list_end = span.end;
+
+    f->seek(m_OffsetTablePos + i * sizeof(uint32_t));
+    f->WriteU32(mxst_offset);
+  }
+
+  if (list_end != m_StreamListEnd) {
+    f->seek(list_end);
+
+    // Fill remainder with padding
+    if (f->pos()%m_BufferSize != 0) {
+      uint32_t current_buf = f->pos() / m_BufferSize;
+      uint32_t target_sz = (current_buf + 1) * m_BufferSize;
+
+      WritePadding(f, target_sz - f->pos());
+    }
+
+    m_StreamListEnd = f->pos();
+    for (size_t i = 0; i < m_StreamLayout.size(); i++) {
+      if (m_StreamLayout[i].limit == list_end) {
+        m_StreamLayout[i].limit = m_StreamListEnd;
+      }
+    }
+
+    // Grow the stream list and the file around it
+    RIFF::Chk list_mxst = {m_StreamListPos + sizeof(uint32_t), m_StreamListPos + kMinimumChunkSize};
+    RIFF::EndChunk(f, list_mxst);
+
+    RIFF::Chk riff = {sizeof(uint32_t), kMinimumChunkSize};
+    RIFF::EndChunk(f, riff);
+  }
+
+  return ERROR_SUCCESS;
+}
+
+void Interleaf::WriteObject(FileBase *f, const Object *o, LayoutReport *report) const
 {
-  WritePaddingIfNecessary(f, o->CalculateMaximumDiskSize());
+  WritePaddingIfNecessary(f, o->GetMaximumDiskSize(), report);
+
+  size_t report_index = 0;
+  if (report) {
+    LayoutReport::Placement p = {o->id(), uint32_t(f->pos()), 0};
+    report_index = report->objects.size();
+    report->objects.push_back(p);
+  }
 
   RIFF::Chk mxob = RIFF::BeginChunk(f, RIFF::MxOb);
 
@@ -531,126 +1395,161 @@ void Interleaf::WriteObject(FileBase *f, const Object *o) const
     f->WriteU32(o->GetChildCount());
 
     for (size_t i = 0; i < o->GetChildCount(); i++) {
-      WriteObject(f, static_cast<Object*>(o->GetChildAt(i)));
+      WriteObject(f, static_cast<Object*>(o->GetChildAt(i)), report);
     }
 
     RIFF::EndChunk(f, list_mxch);
   }
 
   RIFF::EndChunk(f, mxob);
+
+  if (report) {
+    report->objects[report_index].size = uint32_t(f->pos()) - report->objects[report_index].offset;
+  }
 }
 
-struct ChunkStatus
+void PropagateTimeToParents(std::vector<ChunkStatus> &status, size_t i)
 {
-  Object *object;
-  size_t index;
-  uint32_t time;
-};
+  // Parents can't be ahead of their children, so carry this time up for as long as it's later
+  for (size_t p = status[i].parent; p != kNoParent; p = status[p].parent) {
+    ChunkStatus &parent = status[p];
+    if (!parent.active || parent.time >= status[i].time) {
+      break;
+    }
 
-bool HasChildrenThatNeedPriority(Object *parent, uint32_t parent_time, const std::vector<ChunkStatus> &other_jobs)
+    parent.time = status[i].time;
+    i = p;
+  }
+}
+
+// Entries due at the same time as the one just taken can't have anything later above them in the
+// heap, so they're all in one branch from the top and the search stops wherever the time changes
+void FindChunkThatFits(const std::vector<ChunkStatus> &status, const std::vector<ChunkQueueEntry> &queue, size_t j, uint32_t time, uint32_t remaining, size_t *best, size_t *best_size)
 {
-  for (size_t i=0; i<other_jobs.size(); i++) {
-    Object *other_obj = other_jobs.at(i).object;
+  static const uint32_t total_hdr = MxCh::HEADER_SIZE + kMinimumChunkSize;
 
-    if (parent->ContainsChild(other_obj) && other_jobs.at(i).time <= parent_time) {
-      return true;
+  if (j >= queue.size() || queue[j].first != time) {
+    return;
+  }
+
+  const ChunkStatus &other = status[queue[j].second];
+  size_t size = (other.index == other.object->data_.size()) ? 0 : other.object->data_[other.index].size();
+  if (total_hdr + size <= remaining) {
+    if (*best == queue.size() || size > *best_size || (size == *best_size && queue[j].second < queue[*best].second)) {
+      *best = j;
+      *best_size = size;
     }
   }
-  return false;
+
+  FindChunkThatFits(status, queue, j * 2 + 1, time, remaining, best, best_size);
+  FindChunkThatFits(status, queue, j * 2 + 2, time, remaining, best, best_size);
 }
 
-void Interleaf::InterleaveObjects(FileBase *f, const std::vector<Object *> &objects) const
+size_t PickChunkThatFits(uint32_t remaining, const std::vector<ChunkStatus> &status, std::vector<ChunkQueueEntry> &queue, size_t i)
 {
-  std::vector<ChunkStatus> status(objects.size());
+  static const uint32_t total_hdr = MxCh::HEADER_SIZE + kMinimumChunkSize;
+
+  const ChunkStatus &s = status[i];
+  if (s.index == s.object->data_.size() || total_hdr + s.object->data_[s.index].size() <= remaining) {
+    return i;
+  }
+
+  // Anything else ready at the same time can go first without breaking the timing, so use
+  // whichever fills the rest of this buffer the most instead of splitting or padding
+  size_t best = queue.size();
+  size_t best_size = 0;
+  FindChunkThatFits(status, queue, 0, s.time, remaining, &best, &best_size);
 
-  // Set up status vector
-  for (size_t i=0; i<objects.size(); i++) {
-    status[i].object = objects.at(i);
-    status[i].index = 0;
-    status[i].time = status[i].object->time_offset_;
+  if (best == queue.size()) {
+    return i;
   }
 
+  // This one takes the chosen one's place. It came off the top, so it sorts before everything
+  // else due at the same time and only ever has to move up.
+  size_t chosen = queue[best].second;
+  queue[best].second = i;
+  std::push_heap(queue.begin(), queue.begin() + best + 1, std::greater<ChunkQueueEntry>());
+  return chosen;
+}
+
+void Interleaf::InterleaveObjects(FileBase *f, WriteScratch *scratch) const
+{
+  std::vector<ChunkStatus> &status = scratch->status;
+  bool minimize_padding = scratch->flags & WriteMinimizePadding;
+
   // First, interleave headers
-  for (std::vector<ChunkStatus>::iterator it = status.begin(); it != status.end(); ) {
-    ChunkStatus &s = *it;
+  for (size_t i=0; i<status.size(); i++) {
+    ChunkStatus &s = status[i];
     Object *o = s.object;
 
-    bool proceed = true;
-
     if (!o->data().empty()) {
-      WriteSubChunk(f, 0, o->id(), 0xFFFFFFFF, o->data().front());
+      ScheduledChunk header = {o, 0, 0xFFFFFFFF, 0};
+      WriteScheduledChunk(f, scratch, header);
       s.index++;
 
       // If we've already reached the end, write the end chunk now
       if (o->data().size() == s.index) {
-        WriteSubChunk(f, MxCh::FLAG_END, o->id(), 0xFFFFFFFF);
-        it = status.erase(it);
-        proceed = false;
+        ScheduledChunk end = {o, 0, 0xFFFFFFFF, MxCh::FLAG_END};
+        WriteScheduledChunk(f, scratch, end);
+        s.active = false;
       }
     }
-
-    if (proceed) {
-      it++;
-    }
   }
 
-  // Next, interleave the rest based on time
-  while (true) {
-    // Update parent time too
-    bool done = false;
-    while (!done) {
-      done = true;
-      for (size_t j=0; j<status.size(); j++) {
-        ChunkStatus &s = status.at(j);
-        Object *obj = s.object;
-
-        for (size_t i=0; i<status.size(); i++) {
-          ChunkStatus &p = status.at(i);
-          if (p.object != obj) {
-            if (p.object->ContainsChild(obj)) {
-              if (p.time < s.time) {
-                p.time = s.time;
-                done = false;
-              }
-            }
-          }
-        }
+  // Parents start no earlier than their children, and wait for each of them to finish
+  for (size_t i=0; i<status.size(); i++) {
+    if (status[i].active) {
+      PropagateTimeToParents(status, i);
+
+      if (status[i].parent != kNoParent && status[status[i].parent].active) {
+        status[status[i].parent].pending++;
       }
     }
+  }
 
-    // Find next chunk
-    std::vector<ChunkStatus>::iterator s = status.begin();
-    if (s == status.end()) {
-      break;
+  std::vector<ChunkQueueEntry> &queue = scratch->queue;
+  std::greater<ChunkQueueEntry> later;
+  queue.clear();
+  for (size_t i=0; i<status.size(); i++) {
+    if (status[i].active && status[i].pending == 0) {
+      queue.push_back(ChunkQueueEntry(status[i].time, i));
+      std::push_heap(queue.begin(), queue.end(), later);
     }
+  }
 
-    while (HasChildrenThatNeedPriority(s->object, s->time, status)) {
-      s++;
-    }
+  // Next, interleave the rest based on time
+  while (!queue.empty()) {
+    std::pop_heap(queue.begin(), queue.end(), later);
+    size_t i = queue.back().second;
+    queue.pop_back();
 
-    if (s == status.end()) {
-      break;
+    if (minimize_padding) {
+      i = PickChunkThatFits(m_BufferSize - uint32_t(f->pos() % m_BufferSize), status, queue, i);
     }
 
-    std::vector<ChunkStatus>::iterator it = s;
-    it++;
-    for (; it!=status.end(); it++) {
-      // Find earliest chunk to write
-      if (it->time < s->time && !HasChildrenThatNeedPriority(it->object, it->time, status)) {
-        s = it;
-      }
-    }
+    ChunkStatus *s = &status[i];
 
     if (s->index == s->object->data_.size()) {
-      WriteSubChunk(f, MxCh::FLAG_END, s->object->id(), s->time);
-      status.erase(s);
+      ScheduledChunk end = {s->object, 0, s->time, MxCh::FLAG_END};
+      WriteScheduledChunk(f, scratch, end);
+      s->active = false;
+
+      // Parent may now be ready to write
+      if (s->parent != kNoParent) {
+        ChunkStatus &p = status[s->parent];
+        if (p.active && --p.pending == 0) {
+          queue.push_back(ChunkQueueEntry(p.time, s->parent));
+          std::push_heap(queue.begin(), queue.end(), later);
+        }
+      }
       continue;
     }
 
     Object *obj = s->object;
     const bytearray &data = obj->data().at(s->index);
 
-    WriteSubChunk(f, 0, obj->id(), s->time, data);
+    ScheduledChunk chunk = {obj, s->index, s->time, 0};
+    WriteScheduledChunk(f, scratch, chunk);
 
     s->index++;
 
@@ -684,13 +1583,32 @@ void Interleaf::InterleaveObjects(FileBase *f, const std::vector<Object *> &obje
       // Unaffected by time
       break;
     }
+
+    PropagateTimeToParents(status, i);
+    queue.push_back(ChunkQueueEntry(s->time, i));
+    std::push_heap(queue.begin(), queue.end(), later);
+  }
+}
+
+void Interleaf::WriteScheduledChunk(FileBase *f, WriteScratch *scratch, const ScheduledChunk &chunk) const
+{
+  if (scratch->schedule) {
+    scratch->schedule->push_back(chunk);
+  }
+
+  if (chunk.flags & MxCh::FLAG_END) {
+    WriteSubChunk(f, scratch, chunk.flags, chunk.object->id(), chunk.time, bytearray());
+  } else {
+    WriteSubChunk(f, scratch, chunk.flags, chunk.object->id(), chunk.time, chunk.object->data()[chunk.index]);
   }
 }
 
-void Interleaf::WriteSubChunk(FileBase *f, uint16_t flags, uint32_t object, uint32_t time, const bytearray &data) const
+void Interleaf::WriteSubChunk(FileBase *f, WriteScratch *scratch, uint16_t flags, uint32_t object, uint32_t time, const bytearray &data) const
 {
   static const uint32_t total_hdr = MxCh::HEADER_SIZE + kMinimumChunkSize;
 
+  bool minimize_padding = scratch->flags & WriteMinimizePadding;
+
   uint32_t data_offset = 0;
 
   while (data_offset < data.size() || data.size() == 0) {
@@ -712,7 +1630,7 @@ void Interleaf::WriteSubChunk(FileBase *f, uint16_t flags, uint32_t object, uint
         } else {
           // This chunk won't fit in our buffer alignment. We must make a decision to either insert
           // padding or split the clip.
-          WritePadding(f, remaining);
+          WritePadding(f, remaining, scratch->report);
         }
         continue;
       }
@@ -724,10 +1642,15 @@ void Interleaf::WriteSubChunk(FileBase *f, uint16_t flags, uint32_t object, uint
         // FIXME: Not sure exactly what this value is yet, likely to be smaller than this
         static const uint32_t MAX_PADDING = 9882;
 
-        if (remaining < MAX_PADDING) {
+        // When minimizing padding, split whenever at least one byte of data fits. Padding at the
+        // start of a buffer won't help either, which happens when buffers are smaller than
+        // MAX_PADDING.
+        bool pad = minimize_padding ? (max_chunk == 0) : (remaining < MAX_PADDING && remaining != m_BufferSize);
+
+        if (pad) {
           // This chunk won't fit in our buffer alignment. We must make a decision to either insert
           // padding or split the clip.
-          WritePadding(f, remaining);
+          WritePadding(f, remaining, scratch->report);
 
           // Do loop over again
           continue;
@@ -737,9 +1660,14 @@ void Interleaf::WriteSubChunk(FileBase *f, uint16_t flags, uint32_t object, uint
       }
     }
 
-    bytearray chunk = data.mid(data_offset, max_chunk);
-    WriteSubChunkInternal(f, flags, object, time, data_sz, chunk);
-    data_offset += chunk.size();
+    // Write straight from the object's data, where a length of 0 means the rest of it like mid()
+    size_t chunk_sz = data.size() - data_offset;
+    if (max_chunk != 0) {
+      chunk_sz = std::min(chunk_sz, max_chunk);
+    }
+
+    WriteSubChunkInternal(f, scratch->report, flags, object, time, data_sz, data.data() + data_offset, chunk_sz);
+    data_offset += chunk_sz;
 
     if (data.size() == 0) {
       break;
@@ -747,7 +1675,7 @@ void Interleaf::WriteSubChunk(FileBase *f, uint16_t flags, uint32_t object, uint
   }
 }
 
-void Interleaf::WriteSubChunkInternal(FileBase *f, uint16_t flags, uint32_t object, uint32_t time, uint32_t data_sz, const bytearray &data) const
+void Interleaf::WriteSubChunkInternal(FileBase *f, LayoutReport *report, uint16_t flags, uint32_t object, uint32_t time, uint32_t data_sz, const char *data, size_t size) const
 {
   RIFF::Chk mxch = RIFF::BeginChunk(f, RIFF::MxCh);
 
@@ -755,34 +1683,83 @@ void Interleaf::WriteSubChunkInternal(FileBase *f, uint16_t flags, uint32_t obje
   f->WriteU32(object);
   f->WriteU32(time);
   f->WriteU32(data_sz);
-  f->WriteBytes(data);
+  f->WriteData(data, size);
+
+  if (report) {
+    report->chunks++;
+    if (flags & MxCh::FLAG_SPLIT) {
+      report->split_chunks++;
+    }
+
+    // Each piece of a split chunk is given the size of what's left, so the last is all of it
+    LayoutReport::ChunkPlacement c = {object, time, flags, uint32_t(f->pos()), !(flags & MxCh::FLAG_SPLIT) || size >= data_sz};
+    report->chunk_placements.push_back(c);
+  }
 
   RIFF::EndChunk(f, mxch);
 }
 
-void Interleaf::WritePadding(FileBase *f, uint32_t size) const
+void Interleaf::WritePadding(FileBase *f, uint32_t size, LayoutReport *report) const
 {
   if (size < kMinimumChunkSize) {
     return;
   }
 
+  if (report) {
+    report->padding_chunks++;
+    report->padding_bytes += size;
+  }
+
   size -= kMinimumChunkSize;
 
   f->WriteU32(RIFF::pad_);
   f->WriteU32(size);
 
-  bytearray b(size);
-  b.fill(0xCD);
-  f->WriteBytes(b);
+  while (size > 0) {
+    uint32_t piece = std::min(size, uint32_t(sizeof(kPaddingBlock.data)));
+    f->WriteData(kPaddingBlock.data, piece);
+    size -= piece;
+  }
 }
 
-void Interleaf::WritePaddingIfNecessary(FileBase *f, size_t projectedWrite) const
+void Interleaf::WritePaddingIfNecessary(FileBase *f, size_t projectedWrite, LayoutReport *report) const
 {
   size_t projected_end = f->pos() + projectedWrite;
   size_t this_buf = f->pos()/m_BufferSize;
   size_t end_buf = projected_end/m_BufferSize;
   if (this_buf != end_buf) {
-    WritePadding(f, (end_buf * m_BufferSize) - f->pos());
+    WritePadding(f, (end_buf * m_BufferSize) - f->pos(), report);
+  }
+}
+
+bool Interleaf::CanPadTo(uint32_t pos, uint32_t target) const
+{
+  if (pos == target) {
+    return true;
+  }
+
+  // Gaps too small for a padding chunk are only allowed at the end of a buffer, where readers
+  // skip ahead to the next one anyway
+  uint32_t next_buf = (pos / m_BufferSize + 1) * m_BufferSize;
+  if (target < next_buf) {
+    return target - pos >= kMinimumChunkSize;
+  }
+
+  uint32_t last_piece = target % m_BufferSize;
+  return last_piece == 0 || last_piece >= kMinimumChunkSize;
+}
+
+void Interleaf::WritePaddingTo(FileBase *f, uint32_t target) const
+{
+  while (f->pos() < target) {
+    uint32_t next_buf = (f->pos() / m_BufferSize + 1) * m_BufferSize;
+    uint32_t gap = std::min(next_buf, target) - f->pos();
+
+    if (gap < kMinimumChunkSize) {
+      f->seek(gap, File::SeekCurrent);
+    } else {
+      WritePadding(f, gap);
+    }
   }
 }
 
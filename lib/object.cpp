@@ -2,16 +2,70 @@
 
 #include <iostream>
 
+#include "audio.h"
+#include "flic.h"
+#include "interleaf.h"
 #include "othertypes.h"
+#include "quantizer.h"
 #include "util.h"
 
 namespace si {
 
+// How much audio is read from a file at a time while converting it
+static const size_t kAudioReadSize = 64 * 1024;
+
+ChunkingPolicy::ChunkingPolicy(uint32_t buffer_size, size_t threads)
+{
+  buffer_size_ = buffer_size;
+  threads_ = threads;
+}
+
+size_t ChunkingPolicy::GetAudioChunkSize(const WAVFmt &fmt) const
+{
+  static const size_t chunk_hdr = MxCh::HEADER_SIZE + 8;
+
+  size_t sample_size = fmt.Channels * (fmt.BitsPerSample/8);
+  size_t second_in_bytes = sample_size * fmt.SampleRate;
+  if (buffer_size_ == 0 || second_in_bytes == 0) {
+    return second_in_bytes;
+  }
+
+  // Chunk times are in milliseconds, so only use sizes that are a whole number of them
+  uint32_t a = fmt.SampleRate, b = 1000;
+  while (b) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  size_t step = sample_size * (fmt.SampleRate / a);
+
+  if (buffer_size_ < chunk_hdr + step) {
+    return second_in_bytes;
+  }
+
+  // Fit as many chunks of up to a second as possible into each buffer, then grow them to fill it
+  size_t per_buffer = (buffer_size_ + second_in_bytes + chunk_hdr - 1) / (second_in_bytes + chunk_hdr);
+  size_t chunk = (buffer_size_ / per_buffer - chunk_hdr) / step * step;
+
+  return std::max(chunk, step);
+}
+
 Object::Object()
 {
   type_ = MxOb::Null;
   id_ = 0;
   time_offset_ = 0;
+  modified_ = false;
+  disk_size_ = 0;
+  disk_size_dirty_ = true;
+}
+
+Object::~Object()
+{
+  // Leave the tree while still whole, so whatever is indexing it can still see what this was
+  if (GetParent()) {
+    GetParent()->RemoveChild(this);
+  }
 }
 
 #ifdef _WIN32
@@ -54,7 +108,109 @@ bool Object::ExtractToFile(const char *f) const
 
 bool Object::ReplaceWithFile(FileBase *f)
 {
+  return ReplaceWithFile(f, GetChunkingPolicy(), DefaultReplaceFlags);
+}
+
+ChunkingPolicy Object::GetChunkingPolicy() const
+{
+  for (Core *c = GetParent(); c; c = c->GetParent()) {
+    if (Interleaf *interleaf = dynamic_cast<Interleaf*>(c)) {
+      return ChunkingPolicy(interleaf->GetBufferSize());
+    }
+  }
+  return ChunkingPolicy();
+}
+
+bool Object::Rechunk(const ChunkingPolicy &policy)
+{
+  if (filetype() != MxOb::WAV || data_.empty()) {
+    // Nothing else can be divided differently
+    return false;
+  }
+
+  size_t chunk_size = policy.GetAudioChunkSize(*data_.at(0).cast<WAVFmt>());
+  size_t remaining = GetFileBodySize();
+
+  std::vector<bytearray> chunks;
+  chunks.reserve(1 + (remaining + chunk_size - 1) / chunk_size);
+  chunks.push_back(data_.at(0));
+
+  // Each new chunk is filled straight from the pieces of the old ones it spans
+  size_t src = 1;
+  size_t offset = 0;
+  while (remaining) {
+    size_t n = std::min(remaining, chunk_size);
+    chunks.push_back(bytearray());
+    chunks.back().resize(n);
+    char *dst = chunks.back().data();
+
+    for (size_t filled = 0; filled < n; ) {
+      const bytearray &from = data_.at(src);
+      size_t k = std::min(n - filled, from.size() - offset);
+      memcpy(dst + filled, from.data() + offset, k);
+      filled += k;
+      offset += k;
+      if (offset == from.size()) {
+        src++;
+        offset = 0;
+      }
+    }
+
+    remaining -= n;
+  }
+
+  data_.Assign(&chunks);
+
+  MarkModified();
+  return true;
+}
+
+PaletteQuantizer::Palette GetBitmapPalette(const bytearray &info_header)
+{
+  PaletteQuantizer::Palette palette;
+
+  const uint8_t *h = reinterpret_cast<const uint8_t*>(info_header.data());
+  uint32_t header_size = *reinterpret_cast<const uint32_t*>(h);
+  uint16_t bit_count = *reinterpret_cast<const uint16_t*>(h + 14);
+  uint32_t used = *reinterpret_cast<const uint32_t*>(h + 32);
+  if (bit_count != 8) {
+    return palette;
+  }
+
+  // Entries are stored BGRX straight after the header
+  size_t count = used ? std::min(used, uint32_t(256)) : 256;
+  for (size_t i = 0; i < count && header_size + i*4 + 4 <= info_header.size(); i++) {
+    const uint8_t *e = h + header_size + i*4;
+    PaletteQuantizer::Color c;
+    c.b = e[0];
+    c.g = e[1];
+    c.r = e[2];
+    palette.push_back(c);
+  }
+
+  return palette;
+}
+
+void TakeAudioChunks(bytearray *pending, size_t chunk_size, bool all, ChunkedData *data)
+{
+  size_t used = 0;
+  while (pending->size() - used >= chunk_size || (all && used < pending->size())) {
+    size_t max = std::min(pending->size() - used, chunk_size);
+    data->push_back(bytearray(pending->data() + used, max));
+    used += max;
+  }
+  pending->erase(pending->begin(), pending->begin() + used);
+}
+
+bool Object::ReplaceWithFile(FileBase *f, const ChunkingPolicy &policy, int flags)
+{
+  bytearray target_fmt;
+  if ((filetype() == MxOb::WAV || filetype() == MxOb::STL) && !data_.empty()) {
+    target_fmt = data_.at(0);
+  }
+
   data_.clear();
+  MarkModified();
 
   switch (this->filetype()) {
   case MxOb::WAV:
@@ -63,39 +219,109 @@ bool Object::ReplaceWithFile(FileBase *f)
       return false;
     }
 
-    // Skip total size
-    f->ReadU32();
+    FileBase::pos_t riff_end = f->ReadU32();
+    riff_end = std::min(riff_end + f->pos(), f->size());
 
     if (f->ReadU32() != RIFF::WAVE) {
       return false;
     }
 
+    // Only note where the audio is for now so it can be read straight into chunks once the
+    // format is known, wherever the fmt chunk is
     bytearray fmt;
-    bytearray data;
+    FileBase::pos_t data_pos = 0;
+    FileBase::pos_t data_sz = 0;
 
-    while (!f->atEnd()) {
+    while (f->pos() + 8 <= riff_end) {
       uint32_t id = f->ReadU32();
       uint32_t sz = f->ReadU32();
+      FileBase::pos_t start = f->pos();
+
       if (id == RIFF::fmt_) {
         fmt = f->ReadBytes(sz);
-      } else if (id == RIFF::data) {
-        data = f->ReadBytes(sz);
-      } else {
-        f->seek(sz, File::SeekCurrent);
+      } else if (id == RIFF::data && !data_pos) {
+        // Files written while recording sometimes never get their size filled in
+        data_pos = start;
+        data_sz = std::min(FileBase::pos_t(sz), riff_end - start);
       }
+
+      // Chunks are padded to an even size, LIST, fact and anything else is skipped
+      f->seek(start + sz + sz%2);
     }
 
-    if (fmt.empty() || data.empty()) {
+    if (fmt.size() < 16 || !data_sz) {
       return false;
     }
 
+    WAVFmt source;
+    memset(&source, 0, sizeof(source));
+    memcpy(&source, fmt.data(), std::min(fmt.size(), sizeof(source)));
+
+    // Match the format the object had before, since that's what the game will play it as
+    WAVFmt target = source;
+    if ((flags & ConformAudio) && target_fmt.size() >= 16) {
+      const WAVFmt *t = target_fmt.cast<WAVFmt>();
+      target.SampleRate = t->SampleRate;
+      target.Channels = t->Channels;
+      target.BitsPerSample = t->BitsPerSample;
+      target.BlockAlign = target.Channels * (target.BitsPerSample/8);
+      target.ByteRate = target.SampleRate * target.BlockAlign;
+    }
+
+    bool convert = AudioConverter::NeedsConversion(source, target) || (flags & NormalizeAudio);
+    if (convert && !(AudioConverter::IsSupported(source) && AudioConverter::IsSupported(target))) {
+      LogWarning() << "Can't convert WAV format " << source.Format << ", replacing without converting" << std::endl;
+      convert = false;
+      target = source;
+    }
+
+    // Standard part of the header only, anything after it is kept from the file
+    memcpy(fmt.data(), &target, 16);
     data_.push_back(fmt);
-    WAVFmt *fmt_info = fmt.cast<WAVFmt>();
-    size_t second_in_bytes = fmt_info->Channels * fmt_info->SampleRate * (fmt_info->BitsPerSample/8);
-    size_t max;
-    for (size_t i=0; i<data.size(); i+=max) {
-      max = std::min(data.size() - i, second_in_bytes);
-      data_.push_back(bytearray(data.data() + i, max));
+
+    size_t chunk_size = policy.GetAudioChunkSize(target);
+    if (!chunk_size) {
+      return false;
+    }
+
+    f->seek(data_pos);
+
+    if (convert) {
+      AudioConverter converter(source, target);
+
+      // Read whole frames at a time, so converting only ever holds a piece of the clip
+      size_t frame_size = source.Channels * (source.BitsPerSample/8);
+      bytearray block(std::max(kAudioReadSize / frame_size, size_t(1)) * frame_size);
+
+      if (flags & NormalizeAudio) {
+        // The loudest sample isn't known until the end, so measure the whole clip first
+        for (FileBase::pos_t i=0; i<data_sz; i+=block.size()) {
+          FileBase::pos_t n = f->ReadData(block.data(), std::min(data_sz - i, FileBase::pos_t(block.size())));
+          converter.Convert(block.data(), n, NULL);
+        }
+        converter.Finish(NULL);
+        converter.SetGain(converter.NormalizeGain());
+        f->seek(data_pos);
+      }
+
+      uint64_t frames = data_sz / frame_size * target.SampleRate / source.SampleRate;
+      data_.reserve(1 + (frames * target.BlockAlign + chunk_size - 1) / chunk_size);
+
+      // Converted audio waits here until there's a whole chunk of it
+      bytearray pending;
+      for (FileBase::pos_t i=0; i<data_sz; i+=block.size()) {
+        FileBase::pos_t n = f->ReadData(block.data(), std::min(data_sz - i, FileBase::pos_t(block.size())));
+        converter.Convert(block.data(), n, &pending);
+        TakeAudioChunks(&pending, chunk_size, false, &data_);
+      }
+      converter.Finish(&pending);
+      TakeAudioChunks(&pending, chunk_size, true, &data_);
+    } else {
+      data_.reserve(1 + (data_sz + chunk_size - 1) / chunk_size);
+
+      for (FileBase::pos_t i=0; i<data_sz; i+=chunk_size) {
+        data_.push_back(f->ReadBytes(std::min(data_sz - i, FileBase::pos_t(chunk_size))));
+      }
     }
 
     return true;
@@ -117,15 +343,13 @@ bool Object::ReplaceWithFile(FileBase *f)
     hdr.append(f->ReadBytes(smk.TreesSize));
 
     // Place header into data vector
-    data_.resize(smk.Frames + 1);
-    data_[0] = hdr;
+    data_.reserve(smk.Frames + 1);
+    data_.push_back(hdr);
 
     uint32_t *real_sizes = frame_sizes.cast<uint32_t>();
     for (uint32_t i=0; i<smk.Frames; i++) {
       uint32_t sz = real_sizes[i];
-      if (sz > 0) {
-        data_[i+1] = f->ReadBytes(sz);
-      }
+      data_.push_back(sz > 0 ? f->ReadBytes(sz) : bytearray());
     }
     return true;
   }
@@ -134,6 +358,33 @@ bool Object::ReplaceWithFile(FileBase *f)
     BMP bmp;
     f->ReadData(&bmp, sizeof(bmp));
 
+    // biBitCount sits 14 bytes into the info header
+    f->seek(sizeof(bmp) + 14);
+    uint16_t bit_count = f->ReadU16();
+    f->seek(sizeof(bmp));
+
+    MemoryBuffer quantized;
+    if (bit_count > 8 && (flags & ConformBitmap)) {
+      PaletteQuantizer::Image image;
+      f->seek(0);
+      if (!PaletteQuantizer::ReadBMP(f, &image)) {
+        LogWarning() << "Can't quantize " << bit_count << "-bit bitmap, replacing without converting" << std::endl;
+        f->seek(sizeof(bmp));
+      } else {
+        PaletteQuantizer::Settings settings;
+        settings.dither = flags & DitherBitmap;
+        settings.threads = policy.threads();
+        if ((flags & KeepBitmapPalette) && target_fmt.size() >= 40) {
+          settings.fixed_palette = GetBitmapPalette(target_fmt);
+        }
+        PaletteQuantizer::Convert(image, settings, &quantized);
+
+        quantized.seek(0);
+        f = &quantized;
+        f->ReadData(&bmp, sizeof(bmp));
+      }
+    }
+
     bytearray info_header = f->ReadBytes(bmp.DataOffset - f->pos());
     data_.push_back(info_header);
 
@@ -142,6 +393,20 @@ bool Object::ReplaceWithFile(FileBase *f)
 
     return true;
   }
+  case MxOb::FLC:
+  {
+    // Re-encode rather than copying frames so the changed rectangles in SI's frame headers are right
+    FlicCodec::Animation animation;
+    if (!FlicCodec::Decode(f, &animation)) {
+      return false;
+    }
+    std::vector<bytearray> chunks;
+    if (!FlicCodec::Encode(animation, &chunks, policy.threads())) {
+      return false;
+    }
+    data_.Assign(&chunks);
+    return true;
+  }
   case MxOb::OBJ:
   {
     data_.push_back(f->ReadBytes(f->size()));
@@ -278,7 +543,86 @@ size_t Object::GetFileBodySize() const
   return s;
 }
 
-size_t Object::CalculateMaximumDiskSize() const
+void Object::SetExtra(const bytearray &extra)
+{
+  extra_ = extra;
+  MarkModified();
+}
+
+void Object::SetLocation(const Vector3 &location)
+{
+  location_ = location;
+  MarkModified();
+}
+
+void Object::SetUp(const Vector3 &up)
+{
+  up_ = up;
+  MarkModified();
+}
+
+void Object::SetTimeOffset(uint32_t time_offset)
+{
+  time_offset_ = time_offset;
+  MarkModified();
+}
+
+void Object::MarkModified()
+{
+  InvalidateDiskSize();
+
+  // Streams are written per top-level object, so that's the one that needs to know
+  Object *top = this;
+  while (Object *parent = dynamic_cast<Object*>(top->GetParent())) {
+    top = parent;
+  }
+  top->modified_ = true;
+}
+
+void Object::InvalidateDiskSize()
+{
+  // An object's parents are never left with a size kept from before it changed, so once one is
+  // already out of date the rest above it are too
+  for (Object *o = this; o && !o->disk_size_dirty_; o = dynamic_cast<Object*>(o->GetParent())) {
+    o->disk_size_dirty_ = true;
+  }
+}
+
+size_t Object::GetMaximumDiskSize() const
+{
+  if (disk_size_dirty_) {
+    size_t s = CalculateOwnDiskSize();
+
+    if (this->HasChildren()) {
+      s += 16;
+
+      for (size_t i = 0; i < this->GetChildCount(); i++) {
+        s += static_cast<Object*>(this->GetChildAt(i))->GetMaximumDiskSize();
+      }
+    }
+
+    disk_size_ = s;
+    disk_size_dirty_ = false;
+  }
+
+  return disk_size_;
+}
+
+void Object::OnDescendantAdded(Core *child)
+{
+  if (Object *parent = dynamic_cast<Object*>(child->GetParent())) {
+    parent->InvalidateDiskSize();
+  }
+}
+
+void Object::OnDescendantRemoved(Core *child)
+{
+  if (Object *parent = dynamic_cast<Object*>(child->GetParent())) {
+    parent->InvalidateDiskSize();
+  }
+}
+
+size_t Object::CalculateOwnDiskSize() const
 {
   size_t s = 0;
 
@@ -296,25 +640,43 @@ size_t Object::CalculateMaximumDiskSize() const
     }
   }
 
-  if (this->HasChildren()) {
-    s += 16;
+  return s;
+}
 
-    for (size_t i = 0; i < this->GetChildCount(); i++) {
-      s += static_cast<Object*>(this->GetChildAt(i))->CalculateMaximumDiskSize();
-    }
+Object *Object::FindSubObjectWithID(uint32_t id)
+{
+  if (this->id() == id) {
+    return this;
   }
 
-  return s;
+  Interleaf *si = dynamic_cast<Interleaf*>(GetRoot());
+  if (!si) {
+    return SearchSubObjectWithID(id);
+  }
+
+  bool shared;
+  Object *o = si->GetObjectByID(id, &shared);
+  if (!o) {
+    return NULL;
+  }
+
+  // Which of several objects sharing an ID comes first depends on where they are in the tree,
+  // so only then is it worth searching
+  if (shared) {
+    return SearchSubObjectWithID(id);
+  }
+
+  return (o->FindParent(this)) ? o : NULL;
 }
 
-Object *Object::FindSubObjectWithID(uint32_t id)
+Object *Object::SearchSubObjectWithID(uint32_t id)
 {
   if (this->id() == id) {
     return this;
   }
 
   for (Children::const_iterator it=GetChildren().begin(); it!=GetChildren().end(); it++) {
-    if (Object *o = static_cast<Object*>(*it)->FindSubObjectWithID(id)) {
+    if (Object *o = static_cast<Object*>(*it)->SearchSubObjectWithID(id)) {
       return o;
     }
   }
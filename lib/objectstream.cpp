@@ -0,0 +1,207 @@
+#include "objectstream.h"
+
+#include <algorithm>
+
+#include "flic.h"
+#include "othertypes.h"
+
+namespace si {
+
+// WAV needs the most framing, its RIFF header is split around the fmt chunk and data may need padding
+static const size_t kMaxFraming = 3;
+
+ObjectStream::ObjectStream()
+{
+  Close();
+}
+
+ObjectStream::ObjectStream(const Object *object)
+{
+  Open(object);
+}
+
+bool ObjectStream::Open(const Object *object)
+{
+  Close();
+
+  const Object::ChunkedData &data = object->data();
+  if (data.empty()) {
+    return false;
+  }
+
+  // Segments point into the framing, so it must never reallocate
+  m_Framing.reserve(kMaxFraming);
+
+  switch (object->filetype()) {
+  case MxOb::WAV:
+  {
+    const bytearray &fmt = data.at(0);
+    size_t body = object->GetFileBodySize();
+
+    MemoryBuffer head;
+    head.WriteU32(RIFF::RIFF_);
+    head.WriteU32(uint32_t(4 + 8 + fmt.size() + fmt.size()%2 + 8 + body + body%2));
+    head.WriteU32(RIFF::WAVE);
+    head.WriteU32(RIFF::fmt_);
+    head.WriteU32(uint32_t(fmt.size()));
+    AddSegment(AddFraming(head.data()));
+
+    AddSegment(fmt);
+
+    MemoryBuffer mid;
+    if (fmt.size()%2) {
+      mid.WriteU8(0);
+    }
+    mid.WriteU32(RIFF::data);
+    mid.WriteU32(uint32_t(body));
+    AddSegment(AddFraming(mid.data()));
+
+    for (size_t i=1; i<data.size(); i++) {
+      AddSegment(data.at(i));
+    }
+
+    if (body%2) {
+      AddSegment(AddFraming(bytearray(1)));
+    }
+    break;
+  }
+  case MxOb::STL:
+  {
+    uint32_t size = sizeof(BMP);
+    for (size_t i=0; i<data.size(); i++) {
+      size += data.at(i).size();
+    }
+
+    BMP bmp;
+    bmp.Signature = 0x4D42; // 'BM'
+    bmp.FileSize = size;
+    bmp.Reserved = 0;
+    bmp.DataOffset = data.at(0).size() + sizeof(BMP);
+    AddSegment(AddFraming(bytearray(reinterpret_cast<const char*>(&bmp), sizeof(bmp))));
+
+    for (size_t i=0; i<data.size(); i++) {
+      AddSegment(data.at(i));
+    }
+    break;
+  }
+  case MxOb::FLC:
+  {
+    AddSegment(data.at(0));
+
+    // Strip the custom frame headers, frames that were only a header become empty FLIC frames
+    static const char *empty_hdr = "\x10\x00\x00\x00\xfa\xf1\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+    for (size_t i=1; i<data.size(); i++) {
+      const bytearray &frame = data.at(i);
+      if (frame.size() == FlicCodec::kCustomHeaderSize) {
+        AddSegment(empty_hdr, 16);
+      } else if (frame.size() > FlicCodec::kCustomHeaderSize) {
+        AddSegment(frame.data() + FlicCodec::kCustomHeaderSize, frame.size() - FlicCodec::kCustomHeaderSize);
+      }
+    }
+    break;
+  }
+  default:
+    for (size_t i=0; i<data.size(); i++) {
+      AddSegment(data.at(i));
+    }
+    break;
+  }
+
+  return true;
+}
+
+void ObjectStream::Close()
+{
+  m_Segments.clear();
+  m_Offsets.clear();
+  m_Framing.clear();
+  m_Position = 0;
+  m_Size = 0;
+  m_Current = 0;
+}
+
+FileBase::pos_t ObjectStream::pos()
+{
+  return m_Position;
+}
+
+FileBase::pos_t ObjectStream::size()
+{
+  return m_Size;
+}
+
+void ObjectStream::seek(pos_t p, SeekMode s)
+{
+  switch (s) {
+  case SeekStart:
+    m_Position = std::min(p, m_Size);
+    break;
+  case SeekCurrent:
+    m_Position = std::min(m_Position + p, m_Size);
+    break;
+  case SeekEnd:
+    m_Position = (p > m_Size) ? 0 : m_Size - p;
+    break;
+  }
+}
+
+FileBase::pos_t ObjectStream::ReadData(void *data, pos_t size)
+{
+  char *out = static_cast<char*>(data);
+  pos_t total = 0;
+
+  // Sequential reads stay in the segment they left off in, anything else is looked up
+  if (m_Current >= m_Segments.size()
+      || m_Position < m_Offsets[m_Current]
+      || m_Position >= m_Offsets[m_Current] + m_Segments[m_Current].size) {
+    m_Current = std::upper_bound(m_Offsets.begin(), m_Offsets.end(), m_Position) - m_Offsets.begin() - 1;
+  }
+
+  while (total < size && m_Current < m_Segments.size()) {
+    const Segment &seg = m_Segments[m_Current];
+    pos_t offset = m_Position - m_Offsets[m_Current];
+    pos_t n = std::min(size - total, pos_t(seg.size) - offset);
+
+    memcpy(out + total, seg.data + offset, n);
+    total += n;
+    m_Position += n;
+
+    if (offset + n == seg.size) {
+      m_Current++;
+    }
+  }
+
+  return total;
+}
+
+FileBase::pos_t ObjectStream::WriteData(const void *data, pos_t size)
+{
+  return 0;
+}
+
+void ObjectStream::AddSegment(const char *data, size_t size)
+{
+  if (!size) {
+    return;
+  }
+
+  Segment s;
+  s.data = data;
+  s.size = size;
+  m_Segments.push_back(s);
+  m_Offsets.push_back(m_Size);
+  m_Size += size;
+}
+
+void ObjectStream::AddSegment(const bytearray &data)
+{
+  AddSegment(data.data(), data.size());
+}
+
+const bytearray &ObjectStream::AddFraming(const bytearray &data)
+{
+  m_Framing.push_back(data);
+  return m_Framing.back();
+}
+
+}
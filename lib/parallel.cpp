@@ -0,0 +1,147 @@
+#include "parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace si {
+
+class ParallelQueue
+{
+public:
+  ParallelQueue(ParallelJob *job, size_t count)
+  {
+    m_Job = job;
+    m_Count = count;
+    m_Next = 0;
+
+#ifdef _WIN32
+    InitializeCriticalSection(&m_Lock);
+#else
+    pthread_mutex_init(&m_Lock, NULL);
+#endif
+  }
+
+  ~ParallelQueue()
+  {
+#ifdef _WIN32
+    DeleteCriticalSection(&m_Lock);
+#else
+    pthread_mutex_destroy(&m_Lock);
+#endif
+  }
+
+  void Work()
+  {
+    size_t index;
+    while (Take(&index)) {
+      m_Job->Run(index);
+    }
+  }
+
+private:
+  bool Take(size_t *index)
+  {
+#ifdef _WIN32
+    EnterCriticalSection(&m_Lock);
+#else
+    pthread_mutex_lock(&m_Lock);
+#endif
+
+    bool has_work = m_Next < m_Count;
+    if (has_work) {
+      *index = m_Next;
+      m_Next++;
+    }
+
+#ifdef _WIN32
+    LeaveCriticalSection(&m_Lock);
+#else
+    pthread_mutex_unlock(&m_Lock);
+#endif
+
+    return has_work;
+  }
+
+  ParallelJob *m_Job;
+  size_t m_Count;
+  size_t m_Next;
+
+#ifdef _WIN32
+  CRITICAL_SECTION m_Lock;
+#else
+  pthread_mutex_t m_Lock;
+#endif
+
+};
+
+#ifdef _WIN32
+static DWORD WINAPI ParallelThreadMain(LPVOID queue)
+{
+  static_cast<ParallelQueue*>(queue)->Work();
+  return 0;
+}
+#else
+static void *ParallelThreadMain(void *queue)
+{
+  static_cast<ParallelQueue*>(queue)->Work();
+  return NULL;
+}
+#endif
+
+size_t Parallel::GetDefaultThreadCount()
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return std::max(DWORD(1), info.dwNumberOfProcessors);
+#else
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? size_t(cores) : 1;
+#endif
+}
+
+void Parallel::Run(ParallelJob *job, size_t count, size_t threads)
+{
+  if (threads == 0) {
+    threads = GetDefaultThreadCount();
+  }
+  threads = std::min(threads, count);
+
+  ParallelQueue queue(job, count);
+
+  // This thread works too, so start one fewer
+#ifdef _WIN32
+  std::vector<HANDLE> handles;
+  for (size_t i = 1; i < threads; i++) {
+    HANDLE h = CreateThread(NULL, 0, ParallelThreadMain, &queue, 0, NULL);
+    if (h) {
+      handles.push_back(h);
+    }
+  }
+#else
+  std::vector<pthread_t> handles;
+  for (size_t i = 1; i < threads; i++) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, ParallelThreadMain, &queue) == 0) {
+      handles.push_back(t);
+    }
+  }
+#endif
+
+  queue.Work();
+
+  for (size_t i = 0; i < handles.size(); i++) {
+#ifdef _WIN32
+    WaitForSingleObject(handles[i], INFINITE);
+    CloseHandle(handles[i]);
+#else
+    pthread_join(handles[i], NULL);
+#endif
+  }
+}
+
+}
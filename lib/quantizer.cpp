@@ -0,0 +1,565 @@
+#include "quantizer.h"
+
+#include <algorithm>
+
+#include "othertypes.h"
+#include "parallel.h"
+
+namespace si {
+
+// Colors are counted at 5 bits per channel, keeping the sums so each bin's real mean is known
+static const int kBinBits = 5;
+static const size_t kBinCount = 1 << (kBinBits * 3);
+static const int kRefineIterations = 4;
+static const size_t kEntriesPerTask = 1024;
+
+struct HistogramBin
+{
+  uint32_t count;
+  uint64_t r;
+  uint64_t g;
+  uint64_t b;
+};
+
+struct ColorEntry
+{
+  int c[3];
+  uint32_t count;
+};
+
+struct ColorBox
+{
+  size_t begin;
+  size_t end;
+  uint64_t count;
+  int axis;
+  int range;
+};
+
+class ChannelLess
+{
+public:
+  ChannelLess(int axis) : axis_(axis) {}
+
+  bool operator()(const ColorEntry &a, const ColorEntry &b) const
+  {
+    return a.c[axis_] < b.c[axis_];
+  }
+
+private:
+  int axis_;
+
+};
+
+/**
+ * @brief Palette laid out one array per channel so the nearest color search vectorizes
+ */
+class PaletteTable
+{
+public:
+  PaletteTable(const PaletteQuantizer::Palette &palette)
+  {
+    count_ = std::min(palette.size(), size_t(256));
+    for (size_t i = 0; i < count_; i++) {
+      r_[i] = palette[i].r;
+      g_[i] = palette[i].g;
+      b_[i] = palette[i].b;
+    }
+  }
+
+  size_t FindNearest(int r, int g, int b) const
+  {
+    int dist[256];
+    for (size_t i = 0; i < count_; i++) {
+      int dr = r_[i] - r;
+      int dg = g_[i] - g;
+      int db = b_[i] - b;
+      dist[i] = dr*dr + dg*dg + db*db;
+    }
+
+    size_t best = 0;
+    for (size_t i = 1; i < count_; i++) {
+      if (dist[i] < dist[best]) {
+        best = i;
+      }
+    }
+    return best;
+  }
+
+  size_t count() const { return count_; }
+
+private:
+  int r_[256];
+  int g_[256];
+  int b_[256];
+  size_t count_;
+
+};
+
+class HistogramJob : public ParallelJob
+{
+public:
+  HistogramJob(const std::vector<const PaletteQuantizer::Image*> &images, size_t tasks) :
+    images_(images),
+    histograms_(tasks)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    std::vector<HistogramBin> &h = histograms_[index];
+    h.resize(kBinCount);
+    memset(&h[0], 0, kBinCount * sizeof(HistogramBin));
+
+    // Rows are dealt out across every image so a batch of small images still splits evenly
+    size_t row = 0;
+    for (size_t i = 0; i < images_.size(); i++) {
+      const PaletteQuantizer::Image *img = images_[i];
+      size_t stride = img->width * 3;
+
+      for (uint32_t y = 0; y < img->height; y++, row++) {
+        if (row % histograms_.size() != index) {
+          continue;
+        }
+
+        const uint8_t *p = &img->rgb[y * stride];
+        for (uint32_t x = 0; x < img->width; x++, p += 3) {
+          size_t key = (size_t(p[0] >> (8 - kBinBits)) << (kBinBits * 2))
+              | (size_t(p[1] >> (8 - kBinBits)) << kBinBits)
+              | size_t(p[2] >> (8 - kBinBits));
+          HistogramBin &bin = h[key];
+          bin.count++;
+          bin.r += p[0];
+          bin.g += p[1];
+          bin.b += p[2];
+        }
+      }
+    }
+  }
+
+  std::vector<HistogramBin> Merge() const
+  {
+    std::vector<HistogramBin> merged(kBinCount);
+    memset(&merged[0], 0, kBinCount * sizeof(HistogramBin));
+
+    for (size_t i = 0; i < histograms_.size(); i++) {
+      const std::vector<HistogramBin> &h = histograms_[i];
+      for (size_t j = 0; j < kBinCount; j++) {
+        merged[j].count += h[j].count;
+        merged[j].r += h[j].r;
+        merged[j].g += h[j].g;
+        merged[j].b += h[j].b;
+      }
+    }
+
+    return merged;
+  }
+
+private:
+  const std::vector<const PaletteQuantizer::Image*> &images_;
+  std::vector< std::vector<HistogramBin> > histograms_;
+
+};
+
+class NearestColorJob : public ParallelJob
+{
+public:
+  NearestColorJob(const std::vector<ColorEntry> &entries, const PaletteTable &table, std::vector<uint8_t> *nearest) :
+    entries_(entries),
+    table_(table),
+    nearest_(nearest)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    size_t end = std::min((index + 1) * kEntriesPerTask, entries_.size());
+    for (size_t i = index * kEntriesPerTask; i < end; i++) {
+      const ColorEntry &e = entries_[i];
+      (*nearest_)[i] = uint8_t(table_.FindNearest(e.c[0], e.c[1], e.c[2]));
+    }
+  }
+
+private:
+  const std::vector<ColorEntry> &entries_;
+  const PaletteTable &table_;
+  std::vector<uint8_t> *nearest_;
+
+};
+
+class RemapJob : public ParallelJob
+{
+public:
+  RemapJob(const PaletteQuantizer::Image &image, const PaletteTable &table, bytearray *indices) :
+    image_(image),
+    table_(table),
+    indices_(indices)
+  {
+  }
+
+  virtual void Run(size_t index)
+  {
+    const uint8_t *p = &image_.rgb[index * image_.width * 3];
+    char *out = indices_->data() + index * image_.width;
+    for (uint32_t x = 0; x < image_.width; x++, p += 3) {
+      out[x] = char(table_.FindNearest(p[0], p[1], p[2]));
+    }
+  }
+
+private:
+  const PaletteQuantizer::Image &image_;
+  const PaletteTable &table_;
+  bytearray *indices_;
+
+};
+
+void UpdateBox(const std::vector<ColorEntry> &entries, ColorBox *box)
+{
+  int lo[3] = {255, 255, 255};
+  int hi[3] = {0, 0, 0};
+  box->count = 0;
+
+  for (size_t i = box->begin; i < box->end; i++) {
+    const ColorEntry &e = entries[i];
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], e.c[c]);
+      hi[c] = std::max(hi[c], e.c[c]);
+    }
+    box->count += e.count;
+  }
+
+  box->axis = 0;
+  for (int c = 1; c < 3; c++) {
+    if (hi[c] - lo[c] > hi[box->axis] - lo[box->axis]) {
+      box->axis = c;
+    }
+  }
+  box->range = hi[box->axis] - lo[box->axis];
+}
+
+PaletteQuantizer::Color MeanColor(const std::vector<ColorEntry> &entries, size_t begin, size_t end)
+{
+  uint64_t sum[3] = {0, 0, 0};
+  uint64_t count = 0;
+  for (size_t i = begin; i < end; i++) {
+    for (int c = 0; c < 3; c++) {
+      sum[c] += uint64_t(entries[i].c[c]) * entries[i].count;
+    }
+    count += entries[i].count;
+  }
+
+  PaletteQuantizer::Color color;
+  color.r = uint8_t((sum[0] + count/2) / count);
+  color.g = uint8_t((sum[1] + count/2) / count);
+  color.b = uint8_t((sum[2] + count/2) / count);
+  return color;
+}
+
+PaletteQuantizer::Settings::Settings()
+{
+  colors = 256;
+  dither = false;
+  threads = 0;
+}
+
+bool PaletteQuantizer::ReadBMP(FileBase *f, Image *image)
+{
+  BMP bmp;
+  if (f->ReadData(&bmp, sizeof(bmp)) != sizeof(bmp) || bmp.Signature != 0x4D42) {
+    return false;
+  }
+
+  FileBase::pos_t info_start = f->pos();
+  f->ReadU32(); // biSize
+  int32_t width = int32_t(f->ReadU32());
+  int32_t height = int32_t(f->ReadU32());
+  f->ReadU16(); // biPlanes
+  uint16_t bit_count = f->ReadU16();
+  uint32_t compression = f->ReadU32();
+
+  // BI_BITFIELDS is only accepted for 32-bit, where it's almost always the usual BGRX order
+  static const uint32_t BI_RGB = 0;
+  static const uint32_t BI_BITFIELDS = 3;
+  if (width <= 0 || height == 0
+      || !(bit_count == 24 || bit_count == 32)
+      || !(compression == BI_RGB || (bit_count == 32 && compression == BI_BITFIELDS))
+      || bmp.DataOffset < f->pos() - info_start) {
+    return false;
+  }
+
+  // Positive heights are stored bottom row first
+  bool bottom_up = height > 0;
+  image->width = width;
+  image->height = bottom_up ? height : -height;
+
+  size_t bytes_per_pixel = bit_count / 8;
+  size_t stride = (image->width * bytes_per_pixel + 3) & ~size_t(3);
+  image->rgb.resize(size_t(image->width) * image->height * 3);
+
+  f->seek(bmp.DataOffset);
+
+  bytearray row(stride);
+  for (uint32_t y = 0; y < image->height; y++) {
+    if (f->ReadData(row.data(), stride) != stride) {
+      return false;
+    }
+
+    uint32_t dst_y = bottom_up ? image->height - 1 - y : y;
+    uint8_t *dst = &image->rgb[size_t(dst_y) * image->width * 3];
+    const uint8_t *src = reinterpret_cast<const uint8_t*>(row.data());
+    for (uint32_t x = 0; x < image->width; x++, src += bytes_per_pixel, dst += 3) {
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+    }
+  }
+
+  return true;
+}
+
+PaletteQuantizer::Palette PaletteQuantizer::BuildPalette(const std::vector<const Image*> &images, const Settings &settings)
+{
+  if (!settings.fixed_palette.empty()) {
+    Palette p = settings.fixed_palette;
+    if (p.size() > 256) {
+      p.resize(256);
+    }
+    return p;
+  }
+
+  size_t threads = settings.threads ? settings.threads : Parallel::GetDefaultThreadCount();
+
+  HistogramJob histogram_job(images, threads);
+  Parallel::Run(&histogram_job, threads, threads);
+  std::vector<HistogramBin> histogram = histogram_job.Merge();
+
+  // Median cut works on the mean color of every bin that was hit
+  std::vector<ColorEntry> entries;
+  for (size_t i = 0; i < kBinCount; i++) {
+    const HistogramBin &bin = histogram[i];
+    if (bin.count) {
+      ColorEntry e;
+      e.c[0] = int((bin.r + bin.count/2) / bin.count);
+      e.c[1] = int((bin.g + bin.count/2) / bin.count);
+      e.c[2] = int((bin.b + bin.count/2) / bin.count);
+      e.count = bin.count;
+      entries.push_back(e);
+    }
+  }
+  std::vector<HistogramBin>().swap(histogram);
+
+  Palette palette;
+  if (entries.empty()) {
+    return palette;
+  }
+
+  size_t colors = std::max(size_t(1), std::min(settings.colors, size_t(256)));
+
+  std::vector<ColorBox> boxes(1);
+  boxes[0].begin = 0;
+  boxes[0].end = entries.size();
+  UpdateBox(entries, &boxes[0]);
+
+  while (boxes.size() < colors) {
+    // Split whichever box covers the most pixels over the widest span of color
+    size_t pick = boxes.size();
+    uint64_t best = 0;
+    for (size_t i = 0; i < boxes.size(); i++) {
+      uint64_t score = boxes[i].count * uint64_t(boxes[i].range);
+      if (boxes[i].end - boxes[i].begin > 1 && score > best) {
+        best = score;
+        pick = i;
+      }
+    }
+    if (pick == boxes.size()) {
+      break;
+    }
+
+    ColorBox &box = boxes[pick];
+    std::sort(entries.begin() + box.begin, entries.begin() + box.end, ChannelLess(box.axis));
+
+    size_t mid = box.begin + 1;
+    uint64_t below = entries[box.begin].count;
+    while (mid < box.end - 1 && below * 2 < box.count) {
+      below += entries[mid].count;
+      mid++;
+    }
+
+    ColorBox upper;
+    upper.begin = mid;
+    upper.end = box.end;
+    box.end = mid;
+    UpdateBox(entries, &box);
+    UpdateBox(entries, &upper);
+    boxes.push_back(upper);
+  }
+
+  for (size_t i = 0; i < boxes.size(); i++) {
+    palette.push_back(MeanColor(entries, boxes[i].begin, boxes[i].end));
+  }
+
+  // Median cut only splits along one axis at a time, a few rounds of k-means evens out the result
+  std::vector<uint8_t> nearest(entries.size());
+  size_t tasks = (entries.size() + kEntriesPerTask - 1) / kEntriesPerTask;
+
+  for (int iteration = 0; iteration < kRefineIterations; iteration++) {
+    PaletteTable table(palette);
+    NearestColorJob job(entries, table, &nearest);
+    Parallel::Run(&job, tasks, threads);
+
+    std::vector<uint64_t> sums(palette.size() * 4, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+      uint64_t *s = &sums[nearest[i] * 4];
+      s[0] += uint64_t(entries[i].c[0]) * entries[i].count;
+      s[1] += uint64_t(entries[i].c[1]) * entries[i].count;
+      s[2] += uint64_t(entries[i].c[2]) * entries[i].count;
+      s[3] += entries[i].count;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < palette.size(); i++) {
+      const uint64_t *s = &sums[i * 4];
+      if (!s[3]) {
+        // Keep colors nothing maps to as they were
+        continue;
+      }
+
+      Color c;
+      c.r = uint8_t((s[0] + s[3]/2) / s[3]);
+      c.g = uint8_t((s[1] + s[3]/2) / s[3]);
+      c.b = uint8_t((s[2] + s[3]/2) / s[3]);
+      if (c.r != palette[i].r || c.g != palette[i].g || c.b != palette[i].b) {
+        palette[i] = c;
+        changed = true;
+      }
+    }
+
+    if (!changed) {
+      break;
+    }
+  }
+
+  return palette;
+}
+
+void PaletteQuantizer::Remap(const Image &image, const Palette &palette, const Settings &settings, bytearray *indices)
+{
+  indices->resize(size_t(image.width) * image.height);
+  if (indices->empty()) {
+    return;
+  }
+
+  if (palette.empty()) {
+    memset(indices->data(), 0, indices->size());
+    return;
+  }
+
+  PaletteTable table(palette);
+
+  if (!settings.dither) {
+    RemapJob job(image, table, indices);
+    Parallel::Run(&job, image.height, settings.threads);
+    return;
+  }
+
+  // Floyd-Steinberg carries each pixel's error into the ones after it, so this has to run in
+  // order. Errors are kept in sixteenths with a spare entry at each end of the row.
+  size_t w = image.width;
+  std::vector<int> current((w + 2) * 3, 0);
+  std::vector<int> next((w + 2) * 3, 0);
+
+  for (uint32_t y = 0; y < image.height; y++) {
+    const uint8_t *p = &image.rgb[y * w * 3];
+    char *out = indices->data() + y * w;
+    std::fill(next.begin(), next.end(), 0);
+
+    for (size_t x = 0; x < w; x++) {
+      int want[3];
+      int *e = &current[(x + 1) * 3];
+      for (int c = 0; c < 3; c++) {
+        want[c] = std::min(std::max(int(p[x * 3 + c]) + e[c] / 16, 0), 255);
+      }
+
+      size_t idx = table.FindNearest(want[0], want[1], want[2]);
+      out[x] = char(idx);
+
+      int err[3] = {
+        want[0] - palette[idx].r,
+        want[1] - palette[idx].g,
+        want[2] - palette[idx].b
+      };
+
+      for (int c = 0; c < 3; c++) {
+        current[(x + 2) * 3 + c] += err[c] * 7;
+        next[x * 3 + c] += err[c] * 3;
+        next[(x + 1) * 3 + c] += err[c] * 5;
+        next[(x + 2) * 3 + c] += err[c];
+      }
+    }
+
+    current.swap(next);
+  }
+}
+
+void PaletteQuantizer::WriteBMP(FileBase *f, uint32_t width, uint32_t height, const Palette &palette, const bytearray &indices)
+{
+  static const uint32_t kInfoHeaderSize = 40;
+  static const uint32_t kPaletteSize = 256 * 4;
+
+  uint32_t stride = (width + 3) & ~uint32_t(3);
+  uint32_t image_size = stride * height;
+
+  BMP bmp;
+  bmp.Signature = 0x4D42;
+  bmp.DataOffset = sizeof(BMP) + kInfoHeaderSize + kPaletteSize;
+  bmp.FileSize = bmp.DataOffset + image_size;
+  bmp.Reserved = 0;
+  f->WriteData(&bmp, sizeof(bmp));
+
+  // BITMAPINFOHEADER
+  f->WriteU32(kInfoHeaderSize);
+  f->WriteU32(width);
+  f->WriteU32(height);
+  f->WriteU16(1);
+  f->WriteU16(8);
+  f->WriteU32(0);
+  f->WriteU32(image_size);
+  f->WriteU32(0);
+  f->WriteU32(0);
+  f->WriteU32(256);
+  f->WriteU32(0);
+
+  // The game always expects a full 256 entries, unused ones are left black
+  for (size_t i = 0; i < 256; i++) {
+    if (i < palette.size()) {
+      f->WriteU8(palette[i].b);
+      f->WriteU8(palette[i].g);
+      f->WriteU8(palette[i].r);
+    } else {
+      f->WriteU8(0);
+      f->WriteU8(0);
+      f->WriteU8(0);
+    }
+    f->WriteU8(0);
+  }
+
+  bytearray row(stride);
+  memset(row.data(), 0, stride);
+  for (uint32_t y = 0; y < height; y++) {
+    memcpy(row.data(), indices.data() + size_t(height - 1 - y) * width, width);
+    f->WriteBytes(row);
+  }
+}
+
+void PaletteQuantizer::Convert(const Image &image, const Settings &settings, FileBase *f)
+{
+  std::vector<const Image*> images(1, &image);
+  Palette palette = BuildPalette(images, settings);
+
+  bytearray indices;
+  Remap(image, palette, settings, &indices);
+
+  WriteBMP(f, image.width, image.height, palette, indices);
+}
+
+}
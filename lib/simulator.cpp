@@ -0,0 +1,353 @@
+#include "simulator.h"
+
+#include <algorithm>
+
+#include "sitypes.h"
+
+namespace si {
+
+static const uint32_t kMinimumChunkSize = 8;
+
+Interleaf::Error Simulator::Simulate(const char *f, const Settings &settings, SimulationReport *report)
+{
+  File is;
+  if (!is.Open(f, File::Read)) {
+    return Interleaf::ERROR_IO;
+  }
+  return Simulate(&is, settings, report);
+}
+
+#ifdef _WIN32
+Interleaf::Error Simulator::Simulate(const wchar_t *f, const Settings &settings, SimulationReport *report)
+{
+  File is;
+  if (!is.Open(f, File::Read)) {
+    return Interleaf::ERROR_IO;
+  }
+  return Simulate(&is, settings, report);
+}
+#endif
+
+Interleaf::Error Simulator::Simulate(FileBase *f, const Settings &settings, SimulationReport *report)
+{
+  report->streams.clear();
+  report->objects.clear();
+  report->underruns = 0;
+  report->worst_lateness = 0;
+
+  f->seek(0);
+  if (f->ReadU32() != RIFF::RIFF_) {
+    return Interleaf::ERROR_INVALID_INPUT;
+  }
+  FileBase::pos_t riff_end = std::min(FileBase::pos_t(f->ReadU32()) + kMinimumChunkSize, f->size());
+  if (f->ReadU32() != RIFF::OMNI) {
+    return Interleaf::ERROR_INVALID_INPUT;
+  }
+
+  // Only the header and offset table are needed, the streams are found through the latter
+  uint32_t buffer_size = 0;
+  uint32_t buffer_count = 0;
+  std::vector<uint32_t> offsets;
+  while (f->pos() + kMinimumChunkSize <= riff_end && !f->atEnd()) {
+    uint32_t id = f->ReadU32();
+    uint32_t size = f->ReadU32();
+
+    // Like Interleaf::ReadChunk(), don't trust a size that runs past what it's in
+    if (f->pos() + size > riff_end) {
+      return Interleaf::ERROR_INVALID_INPUT;
+    }
+    FileBase::pos_t next = f->pos() + size + size%2;
+
+    if (id == RIFF::MxHd) {
+      if (size < sizeof(uint32_t) * 3) {
+        return Interleaf::ERROR_INVALID_INPUT;
+      }
+      f->ReadU32();
+      buffer_size = f->ReadU32();
+      buffer_count = f->ReadU32();
+    } else if (id == RIFF::MxOf) {
+      if (size < sizeof(uint32_t)) {
+        return Interleaf::ERROR_INVALID_INPUT;
+      }
+      f->ReadU32();
+      offsets.resize((size - sizeof(uint32_t)) / sizeof(uint32_t));
+      for (size_t i = 0; i < offsets.size(); i++) {
+        offsets[i] = f->ReadU32();
+      }
+    } else if (id == RIFF::LIST) {
+      break;
+    }
+
+    f->seek(next);
+  }
+
+  if (buffer_size == 0) {
+    return Interleaf::ERROR_INVALID_BUFFER_SIZE;
+  }
+
+  if (settings.buffer_count) {
+    buffer_count = settings.buffer_count;
+  }
+  buffer_count = std::max(buffer_count, uint32_t(1));
+
+  std::map<uint32_t, SimulationReport::ObjectResult> objects;
+  std::vector<Chunk> chunks;
+
+  for (size_t i = 0; i < offsets.size(); i++) {
+    if (!offsets[i]) {
+      continue;
+    }
+
+    SimulationReport::StreamResult result;
+    uint32_t end;
+    if (!ReadStreamChunks(f, offsets[i], buffer_size, &result.id, &end, &chunks)) {
+      return Interleaf::ERROR_INVALID_INPUT;
+    }
+
+    result.offset = offsets[i];
+    SimulateStream(settings, buffer_size, buffer_count, offsets[i], end, chunks, &result, &objects);
+
+    report->underruns += result.underruns;
+    report->worst_lateness = std::max(report->worst_lateness, result.worst_lateness);
+    report->streams.push_back(result);
+  }
+
+  for (std::map<uint32_t, SimulationReport::ObjectResult>::const_iterator it = objects.begin(); it != objects.end(); it++) {
+    report->objects.push_back(it->second);
+  }
+
+  return Interleaf::ERROR_SUCCESS;
+}
+
+Interleaf::Error Simulator::Simulate(const LayoutReport &layout, const Settings &settings, SimulationReport *report)
+{
+  report->streams.clear();
+  report->objects.clear();
+  report->underruns = 0;
+  report->worst_lateness = 0;
+
+  if (layout.buffer_size == 0) {
+    return Interleaf::ERROR_INVALID_BUFFER_SIZE;
+  }
+
+  uint32_t buffer_count = settings.buffer_count ? settings.buffer_count : layout.buffer_count;
+  buffer_count = std::max(buffer_count, uint32_t(1));
+
+  std::map<uint32_t, SimulationReport::ObjectResult> objects;
+  std::vector<Chunk> chunks;
+
+  // Streams are laid out one after another, and so are the chunks inside them
+  size_t next_chunk = 0;
+  for (size_t i = 0; i < layout.streams.size(); i++) {
+    const LayoutReport::Placement &stream = layout.streams[i];
+    uint32_t end = stream.offset + stream.size;
+
+    chunks.clear();
+    for (; next_chunk < layout.chunk_placements.size() && layout.chunk_placements[next_chunk].end <= end; next_chunk++) {
+      chunks.push_back(layout.chunk_placements[next_chunk]);
+    }
+
+    SimulationReport::StreamResult result;
+    result.id = stream.id;
+    result.offset = stream.offset;
+    SimulateStream(settings, layout.buffer_size, buffer_count, stream.offset, end, chunks, &result, &objects);
+
+    report->underruns += result.underruns;
+    report->worst_lateness = std::max(report->worst_lateness, result.worst_lateness);
+    report->streams.push_back(result);
+  }
+
+  for (std::map<uint32_t, SimulationReport::ObjectResult>::const_iterator it = objects.begin(); it != objects.end(); it++) {
+    report->objects.push_back(it->second);
+  }
+
+  return Interleaf::ERROR_SUCCESS;
+}
+
+bool Simulator::ReadStreamChunks(FileBase *f, uint32_t offset, uint32_t buffer_size, uint32_t *id, uint32_t *end, std::vector<Chunk> *chunks)
+{
+  chunks->clear();
+
+  // Every size is checked against whatever it's inside, so a damaged file can't send us past
+  // the end or back to somewhere we've already been
+  if (FileBase::pos_t(offset) + kMinimumChunkSize > f->size()) {
+    return false;
+  }
+
+  f->seek(offset);
+  if (f->ReadU32() != RIFF::MxSt) {
+    return false;
+  }
+  uint32_t st_size = f->ReadU32();
+  FileBase::pos_t st_end = f->pos() + st_size;
+  if (st_end > f->size()) {
+    return false;
+  }
+  *end = uint32_t(st_end);
+
+  // The top-level object tells us the stream's ID, its children are all inside it too
+  if (f->pos() + kMinimumChunkSize > st_end || f->ReadU32() != RIFF::MxOb) {
+    return false;
+  }
+  uint32_t ob_size = f->ReadU32();
+  FileBase::pos_t ob_end = f->pos() + ob_size + ob_size%2;
+  if (ob_end > st_end) {
+    return false;
+  }
+  f->ReadU16();
+  f->ReadString();
+  f->ReadU32();
+  f->ReadString();
+  *id = f->ReadU32();
+  f->seek(ob_end);
+
+  if (f->pos() + kMinimumChunkSize + sizeof(uint32_t) > st_end || f->ReadU32() != RIFF::LIST) {
+    return false;
+  }
+  uint32_t list_size = f->ReadU32();
+  FileBase::pos_t list_end = f->pos() + list_size;
+  if (list_size < sizeof(uint32_t) || list_end > st_end || f->ReadU32() != RIFF::MxDa) {
+    return false;
+  }
+
+  // Walks chunks the same way Interleaf::ReadChunk() does
+  uint32_t joining_remaining = 0;
+  while (!f->atEnd() && f->pos() + kMinimumChunkSize < list_end) {
+    uint32_t offset_in_buffer = f->pos()%buffer_size;
+    if (offset_in_buffer + kMinimumChunkSize > buffer_size) {
+      f->seek(buffer_size-offset_in_buffer, File::SeekCurrent);
+    }
+
+    if (f->pos() + kMinimumChunkSize > list_end) {
+      return false;
+    }
+
+    uint32_t type = f->ReadU32();
+    uint32_t size = f->ReadU32();
+    FileBase::pos_t data_end = f->pos() + size;
+    if (data_end > list_end) {
+      return false;
+    }
+
+    if (type == RIFF::MxCh) {
+      if (size < MxCh::HEADER_SIZE) {
+        return false;
+      }
+
+      Chunk c;
+      c.flags = f->ReadU16();
+      c.object = f->ReadU32();
+      c.time = f->ReadU32();
+      uint32_t data_sz = f->ReadU32();
+      uint32_t piece = size - MxCh::HEADER_SIZE;
+      c.end = uint32_t(data_end);
+
+      if (c.flags & MxCh::FLAG_SPLIT && joining_remaining > 0) {
+        joining_remaining -= std::min(piece, joining_remaining);
+      } else if (c.flags & MxCh::FLAG_SPLIT) {
+        joining_remaining = data_sz - std::min(piece, data_sz);
+      }
+      c.complete = (joining_remaining == 0);
+
+      chunks->push_back(c);
+    }
+
+    f->seek(data_end + size%2);
+  }
+
+  return true;
+}
+
+void Simulator::SimulateStream(const Settings &settings, uint32_t buffer_size, uint32_t buffer_count, uint32_t offset, uint32_t end, const std::vector<Chunk> &chunks, SimulationReport::StreamResult *result, std::map<uint32_t, SimulationReport::ObjectResult> *objects)
+{
+  double read_time = double(buffer_size) * 1000.0 / (settings.drive_speed * kSingleSpeedRate);
+
+  uint32_t first_buffer = offset / buffer_size;
+  size_t buffers = (end - 1) / buffer_size - first_buffer + 1;
+
+  // When each buffer finishes reading, and when everything in it has been played so it can be
+  // reused
+  std::vector<double> arrival(buffers);
+  std::vector<double> release(buffers);
+
+  result->start_time = 0;
+  result->stall_time = 0;
+  result->underruns = 0;
+  result->worst_lateness = 0;
+  result->occupancy.clear();
+
+  double drive = settings.seek_time;
+  size_t c = 0;
+
+  for (size_t k = 0; k < buffers; k++) {
+    // Buffers are reused in order, so wait for the one this will go into to be released
+    double start = drive;
+    if (k >= buffer_count && release[k - buffer_count] > start) {
+      result->stall_time += release[k - buffer_count] - start;
+      start = release[k - buffer_count];
+    }
+
+    arrival[k] = start + read_time;
+    release[k] = arrival[k];
+    drive = arrival[k];
+
+    if (k == 0) {
+      result->start_time = arrival[k];
+    }
+
+    uint32_t buffer_end = (first_buffer + uint32_t(k) + 1) * buffer_size;
+    for (; c < chunks.size() && chunks[c].end <= buffer_end; c++) {
+      const Chunk &ch = chunks[c];
+
+      // Headers and unfinished pieces of split chunks are used as soon as they arrive
+      if (!ch.complete || ch.time == 0xFFFFFFFF) {
+        continue;
+      }
+
+      double due = result->start_time + ch.time;
+      release[k] = std::max(release[k], due);
+
+      if (ch.flags & MxCh::FLAG_END) {
+        continue;
+      }
+
+      SimulationReport::ObjectResult &o = (*objects)[ch.object];
+      if (o.chunks == 0) {
+        o.id = ch.object;
+        o.underruns = 0;
+        o.worst_lateness = 0;
+      }
+      o.chunks++;
+
+      double lateness = arrival[k] - due;
+      if (lateness > 0) {
+        o.underruns++;
+        result->underruns++;
+        o.worst_lateness = std::max(o.worst_lateness, lateness);
+        result->worst_lateness = std::max(result->worst_lateness, lateness);
+      }
+    }
+  }
+
+  // Releases sort before arrivals at the same time so a reused buffer isn't counted twice
+  std::vector< std::pair<double, int> > events;
+  for (size_t k = 0; k < buffers; k++) {
+    events.push_back(std::pair<double, int>(arrival[k], 1));
+    events.push_back(std::pair<double, int>(release[k], -1));
+  }
+  std::sort(events.begin(), events.end());
+
+  uint32_t in_use = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    in_use += events[i].second;
+
+    if (!result->occupancy.empty() && result->occupancy.back().time == events[i].first) {
+      result->occupancy.back().buffers = in_use;
+    } else {
+      SimulationReport::Occupancy sample = {events[i].first, in_use};
+      result->occupancy.push_back(sample);
+    }
+  }
+}
+
+}
@@ -0,0 +1,121 @@
+#include "tuner.h"
+
+namespace si {
+
+static const uint32_t kMinimumChunkSize = 8;
+
+BufferTuner::Settings::Settings()
+{
+  for (uint32_t size = 0x4000; size <= 0x40000; size *= 2) {
+    buffer_sizes.push_back(size);
+  }
+
+  for (uint32_t count = 2; count <= 16; count *= 2) {
+    buffer_counts.push_back(count);
+  }
+
+  write_flags = 0;
+}
+
+Interleaf::Error BufferTuner::Tune(Interleaf *interleaf, const Settings &settings, BufferTuning *tuning)
+{
+  tuning->candidates.clear();
+  tuning->recommended = 0;
+
+  // Stream headers can't be split, so the biggest one sets the smallest usable buffer
+  size_t largest_header = 0;
+  for (size_t i = 0; i < interleaf->GetChildCount(); i++) {
+    const Object *o = static_cast<const Object*>(interleaf->GetChildAt(i));
+    if (o->type() != MxOb::Null) {
+      largest_header = std::max(largest_header, o->GetMaximumDiskSize() + kMinimumChunkSize);
+    }
+  }
+
+  uint32_t original_size = interleaf->GetBufferSize();
+  Interleaf::Error e = Interleaf::ERROR_SUCCESS;
+
+  for (size_t i = 0; i < settings.buffer_sizes.size() && e == Interleaf::ERROR_SUCCESS; i++) {
+    BufferTuning::Candidate c;
+    memset(&c, 0, sizeof(c));
+    c.buffer_size = settings.buffer_sizes[i];
+    c.valid = c.buffer_size != 0 && largest_header <= c.buffer_size;
+
+    if (!c.valid) {
+      for (size_t j = 0; j < settings.buffer_counts.size(); j++) {
+        c.buffer_count = settings.buffer_counts[j];
+        tuning->candidates.push_back(c);
+      }
+      continue;
+    }
+
+    interleaf->SetBufferSize(c.buffer_size);
+
+    LayoutReport plan;
+    e = interleaf->PlanLayout(&plan, settings.write_flags);
+    if (e != Interleaf::ERROR_SUCCESS) {
+      break;
+    }
+
+    c.file_size = plan.file_size;
+    c.padding_bytes = plan.padding_bytes;
+    c.split_chunks = plan.split_chunks;
+
+    for (size_t j = 0; j < settings.buffer_counts.size(); j++) {
+      c.buffer_count = settings.buffer_counts[j];
+
+      Simulator::Settings drive = settings.drive;
+      drive.buffer_count = c.buffer_count;
+
+      SimulationReport report;
+      e = Simulator::Simulate(plan, drive, &report);
+      if (e != Interleaf::ERROR_SUCCESS) {
+        break;
+      }
+
+      c.underruns = report.underruns;
+      c.worst_lateness = report.worst_lateness;
+
+      uint32_t peak_buffers = 0;
+      for (size_t k = 0; k < report.streams.size(); k++) {
+        const std::vector<SimulationReport::Occupancy> &occupancy = report.streams[k].occupancy;
+        for (size_t m = 0; m < occupancy.size(); m++) {
+          peak_buffers = std::max(peak_buffers, occupancy[m].buffers);
+        }
+      }
+      c.peak_memory = uint64_t(peak_buffers) * c.buffer_size;
+
+      tuning->candidates.push_back(c);
+    }
+  }
+
+  interleaf->SetBufferSize(original_size);
+
+  if (e != Interleaf::ERROR_SUCCESS) {
+    return e;
+  }
+
+  tuning->recommended = tuning->candidates.size();
+  for (size_t i = 0; i < tuning->candidates.size(); i++) {
+    const BufferTuning::Candidate &c = tuning->candidates[i];
+    if (c.valid && (tuning->recommended == tuning->candidates.size() || IsBetter(c, tuning->candidates[tuning->recommended]))) {
+      tuning->recommended = i;
+    }
+  }
+
+  return Interleaf::ERROR_SUCCESS;
+}
+
+bool BufferTuner::IsBetter(const BufferTuning::Candidate &a, const BufferTuning::Candidate &b)
+{
+  if (a.underruns != b.underruns) {
+    return a.underruns < b.underruns;
+  }
+
+  if (a.file_size != b.file_size) {
+    return a.file_size < b.file_size;
+  }
+
+  return a.peak_memory < b.peak_memory;
+}
+
+}
@@ -0,0 +1,179 @@
+// Saves the same streams with few and many chunks each, and fails if the writer allocates more
+// for the extra chunks. Counting goes through a replacement operator new.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <interleaf.h>
+#include <object.h>
+
+using namespace si;
+
+static size_t g_Allocations = 0;
+
+void *operator new(std::size_t size) throw(std::bad_alloc)
+{
+  g_Allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](std::size_t size) throw(std::bad_alloc)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+  free(p);
+}
+
+// Keeps track of where a write would be without storing any of it, so only the writer allocates
+class NullBuffer : public FileBase
+{
+public:
+  NullBuffer()
+  {
+    m_Position = 0;
+    m_Size = 0;
+  }
+
+  virtual pos_t pos() { return m_Position; }
+  virtual pos_t size() { return m_Size; }
+
+  virtual void seek(pos_t p, SeekMode s = SeekStart)
+  {
+    switch (s) {
+    case SeekStart:
+      m_Position = p;
+      break;
+    case SeekCurrent:
+      m_Position += p;
+      break;
+    case SeekEnd:
+      m_Position = m_Size - p;
+      break;
+    }
+  }
+
+  virtual pos_t ReadData(void *data, pos_t size) { return 0; }
+
+  virtual pos_t WriteData(const void *data, pos_t size)
+  {
+    m_Position += size;
+    if (m_Position > m_Size) {
+      m_Size = m_Position;
+    }
+    return size;
+  }
+
+private:
+  pos_t m_Position;
+  pos_t m_Size;
+
+};
+
+static const uint32_t kBufferSize = 0x4000;
+static const size_t kStreamCount = 8;
+static const size_t kObjectsPerStream = 4;
+
+static void AddObjects(Core *parent, size_t count, size_t chunks, uint32_t *id)
+{
+  for (size_t i = 0; i < count; i++) {
+    Object *o = new Object();
+    o->type_ = MxOb::Object;
+    o->filetype_ = MxOb::OBJ;
+    o->id_ = (*id)++;
+    o->name_ = "object";
+    o->filename_ = "C:\\object.obj";
+
+    // Sizes that leave awkward gaps at buffer boundaries, and some bigger than a buffer so
+    // they have to be split
+    for (size_t j = 0; j < chunks; j++) {
+      o->data_.push_back(bytearray(1 + (o->id_ * 7919 + j * 4801) % (kBufferSize + kBufferSize / 2)));
+    }
+
+    parent->AppendChild(o);
+  }
+}
+
+static void Build(Interleaf *si, size_t chunks)
+{
+  si->SetBufferSize(kBufferSize);
+  si->SetBufferCount(4);
+
+  uint32_t id = 0;
+  for (size_t i = 0; i < kStreamCount; i++) {
+    Object *stream = new Object();
+    stream->type_ = MxOb::Presenter;
+    stream->id_ = id++;
+    stream->name_ = "stream";
+    si->AppendChild(stream);
+
+    AddObjects(stream, kObjectsPerStream, chunks, &id);
+  }
+}
+
+static bool CountSave(size_t chunks, int flags, size_t *allocations)
+{
+  Interleaf si;
+  Build(&si, chunks);
+
+  NullBuffer out;
+  size_t before = g_Allocations;
+  if (si.Write(&out, flags) != Interleaf::ERROR_SUCCESS) {
+    return false;
+  }
+  *allocations = g_Allocations - before;
+
+  printf("flags %d, %lu chunks: %lu allocations\n", flags,
+         (unsigned long) (kStreamCount * kObjectsPerStream * chunks), (unsigned long) *allocations);
+  return true;
+}
+
+int main()
+{
+  // Without interposition none of the library's allocations would be seen, and every save
+  // would look allocation-free. The first chunk added to an object is allocated by
+  // ChunkedData inside libweaver, with nothing allocated here.
+  Object probe;
+  bytearray empty;
+  size_t before = g_Allocations;
+  probe.data_.push_back(empty);
+  if (g_Allocations == before) {
+    printf("operator new isn't replaced inside libweaver, skipping\n");
+    return 77;
+  }
+
+  static const size_t kFewChunks = 16;
+  static const size_t kManyChunks = 256;
+  static const int kFlags[] = {0, Interleaf::WriteMinimizePadding};
+
+  int result = EXIT_SUCCESS;
+
+  for (size_t i = 0; i < sizeof(kFlags) / sizeof(kFlags[0]); i++) {
+    size_t few = 0, many = 0;
+    if (!CountSave(kFewChunks, kFlags[i], &few) || !CountSave(kManyChunks, kFlags[i], &many)) {
+      printf("save failed\n");
+      return EXIT_FAILURE;
+    }
+
+    // Allocating per stream or per object is fine, those are the same in both saves
+    if (many > few) {
+      printf("flags %d: %lu more allocations for %lu more chunks\n", kFlags[i],
+             (unsigned long) (many - few), (unsigned long) (kStreamCount * kObjectsPerStream * (kManyChunks - kFewChunks)));
+      result = EXIT_FAILURE;
+    }
+  }
+
+  return result;
+}